@@ -105,14 +105,17 @@ libMesa_SRC_FILES := \
     src/mesa/program/prog_parameter.cpp \
     src/mesa/program/symbol_table.c \
     src/pixelflinger2/buffer.cpp \
+    src/pixelflinger2/convert.cpp \
     src/pixelflinger2/format.cpp \
     src/pixelflinger2/llvm_scanline.cpp \
     src/pixelflinger2/llvm_texture.cpp \
     src/pixelflinger2/pixelflinger2.cpp \
+    src/pixelflinger2/present.cpp \
     src/pixelflinger2/raster.cpp \
     src/pixelflinger2/scanline.cpp \
     src/pixelflinger2/shader.cpp \
     src/pixelflinger2/texture.cpp \
+    src/pixelflinger2/tile.cpp \
     src/talloc/hieralloc.c
 
 libMesa_C_INCLUDES := \
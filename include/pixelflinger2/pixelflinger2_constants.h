@@ -40,5 +40,19 @@
 #define GGL_FS_OUTPUT_FRAGCOLOR_INDEX   0
 
 #define GGL_MAX_VIEWPORT_DIMS           4096
+#define GGL_MAX_TEXTURE_LEVELS          16 // levels past this are not sampled
+
+// LLVM passes run on JIT'd shader and scanline functions before code generation
+#define GGL_SHADER_PASS_MEM2REG         0x01 // promote locals to SSA registers
+#define GGL_SHADER_PASS_SROA            0x02 // split local arrays and structs into scalars
+#define GGL_SHADER_PASS_INSTCOMBINE     0x04
+#define GGL_SHADER_PASS_GVN             0x08 // remove redundant loads and expressions
+#define GGL_SHADER_PASS_SIMPLIFYCFG     0x10
+#define GGL_SHADER_PASS_BBVECTORIZE     0x20 // combine scalar ops into vectors, slow to run
+#define GGL_SHADER_PASS_LICM            0x40 // hoist invariant loads out of the span loop
+#define GGL_SHADER_PASSES_DEFAULT       0x5f
+#define GGL_SHADER_PASSES_ALL           0x7f
+
+#define GGL_MAX_PENDING_FRAMES          3 // SubmitFrame blocks while this many are queued
 
 #endif // _PIXELFLINGER2_CONSTANTS_H_
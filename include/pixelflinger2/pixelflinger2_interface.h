@@ -41,6 +41,7 @@ typedef struct VertexOutput {
    Vector4 varyings[GGL_MAXVARYINGVECTORS];
    Vector4 frontFacingPointCoord; // frag input, gl_FrontFacing gl_PointCoord yzw
    Vector4 fragColor[GGL_MAXDRAWBUFFERS]; // frag output, gl_FragData
+   Vector4 discarded; // frag output, x is nonzero once the fragment is discarded
 }
 #ifndef __arm__
 __attribute__ ((aligned (16)))
@@ -85,6 +86,22 @@ typedef struct GGLTexture {
    1; // only GGL_NEAREST and GGL_LINEAR
 } GGLTexture_t;
 
+// texture container that can be mmaped and passed to SetSampler without copying;
+// levels follow the header at GGL_TEXTURE_FILE_DATA_OFFSET in the GGLTexture::levels layout
+#define GGL_TEXTURE_FILE_MAGIC 0x32465047 /* "GPF2" little endian */
+#define GGL_TEXTURE_FILE_VERSION 1
+#define GGL_TEXTURE_FILE_DATA_OFFSET 4096 /* page aligned */
+#define GGL_TEXTURE_FILE_TILING_LINEAR 0 /* rows of texels, the only tiling sampled */
+
+typedef struct GGLTextureFileHeader {
+   unsigned magic, version;
+   unsigned type; // GL_TEXTURE_2D, or GL_TEXTURE_CUBE_MAP
+   unsigned format; // enum GGLPixelFormat
+   unsigned width, height, levelCount;
+   unsigned tiling;
+   unsigned dataOffset, dataSize; // bytes from start of file
+} GGLTextureFileHeader_t;
+
 typedef struct GGLStencilState {
    unsigned char ref, mask; // ref is masked during StencilFuncSeparate
 
@@ -112,6 +129,12 @@ unsigned depthTest :
    // GL_GEQUAL, GL_ALWAYS = 7; value = GLenum  & 0x7 (GLenum is 0x200-0x207)
 unsigned depthFunc :
    3;
+unsigned dither :
+   1; // GL_DITHER, ordered dither when packing RGB_565
+unsigned multisample :
+   1; // 4x multisample buffers with per sample depth and stencil, see SetMultisample
+unsigned sharedDepthStencil :
+   1; // depth and stencil are the same SZ_24 surface, tested with one load and store
 } GGLBufferState_t;
 
 typedef struct GGLBlendState { // all values affect scanline jit
@@ -141,13 +164,25 @@ unsigned enable :
    1;
 } GGLBlendState_t;
 
+// addressing parameters of a sampler derived from its texture by SetSampler;
+// used by LLVM generated texture sampler, layout must match SamplerDescriptorType
+typedef struct GGLSamplerDescriptor {
+   void * data; // GGLTexture::levels
+   unsigned width, height; // base level dimension
+   unsigned widthMask, heightMask; // width - 1 and height - 1, max texel coordinates
+   // log2 of width if width and height are power of 2, otherwise 0; affects vs/fs jit
+   unsigned widthShift;
+   unsigned stride; // texels per row of base level
+   unsigned faceSize; // texels in base level of a face
+   unsigned maxLevel; // levelCount - 1, sampling with a LOD clamps the level to it
+   unsigned levelOffsets[GGL_MAX_TEXTURE_LEVELS]; // TextureLevelOffset of face 0 of each level
+} GGLSamplerDescriptor_t;
+
 typedef struct GGLTextureState {
    // format affects vs and fs jit
    GGLTexture_t textures[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS]; // the active samplers
-   // array of pointers to texture surface data synced to textures; used by LLVM generated texture sampler
-   void * textureData[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
-   // array of texture dimensions synced to textures; by LLVM generated texture sampler
-   unsigned textureDimensions[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 2];
+   // synced to textures by SetSampler
+   GGLSamplerDescriptor_t samplers[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
 } GGLTextureState_t;
 
 typedef struct GGLState {
@@ -191,14 +226,83 @@ struct GGLInterface {
    void (* ClearColor)(GGLInterface_t * iface, GLclampf r, GLclampf g, GLclampf b, GLclampf a);
    void (* ClearDepthf)(GGLInterface_t * iface, GLclampf d);
    void (* Clear)(const GGLInterface_t * iface, GLbitfield buf);
+   // when enabled, Clear tags screen tiles instead of writing surface memory;
+   // tiles are filled when first drawn to, or by Finish
+   void (* LazyClear)(GGLInterface_t * iface, GLboolean enable);
+   // completes deferred work so surface memory can be accessed directly
+   void (* Finish)(const GGLInterface_t * iface);
+   // when enabled, rendering goes to 4x multisample color, depth and stencil buffers owned by
+   // the context and allocated for the currently set surfaces; fragment shader runs once per
+   // pixel while depth and stencil are tested per covered sample
+   void (* SetMultisample)(GGLInterface_t * iface, GLboolean enable);
+   // averages the color samples into the color buffer, also done by Finish
+   void (* ResolveMultisample)(const GGLInterface_t * iface);
+   // calls draw once for each screen tile with rendering, Clear included, redirected to cache
+   // resident tile buffers; buffers are loaded from the surfaces when first drawn to and
+   // written back once after draw returns; draw must issue the same work for every tile and
+   // must not set buffers or multisampling; not available with multisampling
+   void (* RenderTiles)(GGLInterface_t * iface, void (* draw)(GGLInterface_t * iface, void * user),
+                        void * user);
+   // marks contents of GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT, GL_STENCIL_BUFFER_BIT as
+   // undefined until cleared, so RenderTiles neither loads nor writes them back; call at end of
+   // draw to discard depth and stencil of the frame
+   void (* InvalidateBuffers)(const GGLInterface_t * iface, GLbitfield buf);
+
+   // queues a frame that calls draw with the color buffer set to surface (NULL keeps the
+   // current one), completes it like Finish, then calls present if not NULL, all on the
+   // present thread; returns the fence of the frame, blocks while GGL_MAX_PENDING_FRAMES are
+   // queued; until the last submitted fence completes, other threads may only call
+   // SubmitFrame and WaitFence, so queue frames into alternating surfaces to overlap
+   unsigned (* SubmitFrame)(GGLInterface_t * iface, const GGLSurface_t * surface,
+                            void (* draw)(GGLInterface_t * iface, void * user),
+                            void (* present)(GGLInterface_t * iface, const GGLSurface_t * surface,
+                                             void * user), void * user);
+   // blocks until the frame of fence has been presented, 0 waits for all submitted frames
+   void (* WaitFence)(const GGLInterface_t * iface, unsigned fence);
+
+   // reads the width x height rectangle at x, y of the color buffer into pixels of format
+   // with stride (in pixels, 0 means width)
+   void (* ReadPixels)(const GGLInterface_t * iface, GLint x, GLint y, GLsizei width,
+                       GLsizei height, enum GGLPixelFormat format, unsigned stride, void * pixels);
+   // copies the width x height rectangle at srcX, srcY of src to dstX, dstY of dst,
+   // converting format; surfaces may be the same if the rectangles have the same format
+   void (* CopySurface)(const GGLInterface_t * iface, GGLSurface_t * dst, GLint dstX, GLint dstY,
+                        const GGLSurface_t * src, GLint srcX, GLint srcY, GLsizei width,
+                        GLsizei height);
+   // stretches the src rectangle onto the dst rectangle with GL_NEAREST or GL_LINEAR filter,
+   // converting format; rectangles must not overlap
+   void (* BlitSurface)(const GGLInterface_t * iface, GGLSurface_t * dst, GLint dstX, GLint dstY,
+                        GLsizei dstWidth, GLsizei dstHeight, const GGLSurface_t * src,
+                        GLint srcX, GLint srcY, GLsizei srcWidth, GLsizei srcHeight, GLenum filter);
+
+   // converts pixels of format with stride (in pixels, 0 means width) into level of face
+   // (0 for GL_TEXTURE_2D, 0 to 5 for cube map +x,-x,+y,-y,+z,-z); texture->levels must
+   // point to GGLTextureLevelsSize bytes; optionally premultiplies rgb by alpha
+   void (* TexImage)(GGLInterface_t * iface, GGLTexture_t * texture, unsigned level, unsigned face,
+                     enum GGLPixelFormat format, unsigned stride, const void * pixels,
+                     GLboolean premultiply);
+   // same as TexImage for the width x height sub rectangle at x, y
+   void (* TexSubImage)(GGLInterface_t * iface, GGLTexture_t * texture, unsigned level,
+                        unsigned face, GLint x, GLint y, GLsizei width, GLsizei height,
+                        enum GGLPixelFormat format, unsigned stride, const void * pixels,
+                        GLboolean premultiply);
+   // box filters level 0 of each face into levels 1 to levelCount - 1
+   void (* GenerateMipmap)(GGLInterface_t * iface, GGLTexture_t * texture);
 
    // shallow copy, surface data pointed to must be valid until texture is set to another texture
    // libAgl2 needs to check ret of ShaderUniform to detect assigning to sampler unit
    void (* SetSampler)(GGLInterface_t * iface, const unsigned sampler, GGLTexture_t * texture);
 
    // shallow copy, surface data must remain valid; use GL_COLOR_BUFFER_BIT,
-   // GL_DEPTH_BUFFER_BIT, GL_STENCIL_BUFFER_BIT; format must be RGBA_8888, Z_32 or S_8
+   // GL_DEPTH_BUFFER_BIT, GL_STENCIL_BUFFER_BIT; color format must be RGBA_8888, BGRA_8888,
+   // RGBX_8888 or RGB_565, depth Z_32 or Z_16, and stencil S_8;
+   // a SZ_24 surface set as both depth and stencil packs them into one 32 bit pixel
    void (* SetBuffer)(GGLInterface_t * iface, const GLenum type, GGLSurface_t * surface);
+   // sets level of face of texture as the color buffer, so it is rendered to in place and can
+   // be sampled by later passes without a copy; format must be RGBA_8888, RGBX_8888 or RGB_565;
+   // texture->levels must remain valid, NULL texture unsets the color buffer
+   void (* SetBufferTexture)(GGLInterface_t * iface, GGLTexture_t * texture, unsigned level,
+                             unsigned face);
 
 
    // runs active vertex shader using currently set program; no error checking
@@ -243,6 +347,11 @@ struct GGLInterface {
 
    // duplicates shaders to program, and links varyings / attributes
    GLboolean (* ShaderProgramLink)(gl_shader_program_t * program, const char ** infoLog);
+   // sets the GGL_SHADER_PASS_* bits run when program is JIT'd, GGL_SHADER_PASSES_DEFAULT initially
+   void (* ShaderProgramPasses)(gl_shader_program_t * program, GLbitfield passes);
+   // dumps instances of program JIT'd from now on to directory, NULL stops;
+   // PF2_SHADER_DUMP=<directory> sets it for every program created
+   void (* ShaderProgramDump)(gl_shader_program_t * program, const char * directory);
    // frees program
    void (* ShaderProgramDelete)(GGLInterface_t * iface, gl_shader_program_t * program);
 
@@ -296,6 +405,17 @@ extern "C"
 
    void DestroyGGLInterface(GGLInterface_t * interface);
 
+   // bytes needed for GGLTexture::levels of all levels and faces of texture
+   unsigned GGLTextureLevelsSize(const GGLTexture_t * texture);
+
+   // maps a texture container file read only and fills texture, levels point into the mapping;
+   // wrap and filter are set to defaults; returns GL_FALSE if the file is invalid
+   GLboolean GGLTextureMapFile(const char * path, GGLTexture_t * texture);
+   // unmaps levels of a texture filled by GGLTextureMapFile
+   void GGLTextureUnmapFile(GGLTexture_t * texture);
+   // writes texture and its levels into a texture container file
+   GLboolean GGLTextureWriteFile(const char * path, const GGLTexture_t * texture);
+
    // creates empty shader
    gl_shader_t * GGLShaderCreate(GLenum type);
 
@@ -316,6 +436,13 @@ extern "C"
    // duplicates shaders to program, and links varyings / attributes;
    GLboolean GGLShaderProgramLink(gl_shader_program_t * program, const char ** infoLog);
 
+   // sets the GGL_SHADER_PASS_* bits run when program is JIT'd, GGL_SHADER_PASSES_DEFAULT initially
+   void GGLShaderProgramPasses(gl_shader_program_t * program, GLbitfield passes);
+
+   // dumps GLSL IR, LLVM IR before and after passes, object code and sizes of instances
+   // of program JIT'd from now on to directory, NULL stops
+   void GGLShaderProgramDump(gl_shader_program_t * program, const char * directory);
+
    // frees program
    void GGLShaderProgramDelete(gl_shader_program_t * program);
 
@@ -353,11 +480,16 @@ extern "C"
                          VertexOutput_t * output, const float (*constants)[4]);
 
    // scan line given left and right processed and scizored vertices
-   // depth value bitcast float->int, if negative then ^= 0x7fffffff
+   // Z_32 depth value bitcast float->int, if negative then ^= 0x7fffffff;
+   // SZ_24 depth value is 24 bit unorm in low bits, stencil in high 8 bits; Z_16 is 16 bit unorm
+   // coverage is NULL, or a 4 bit sample mask per pixel from start to end for multisample
+   // buffers with 4 consecutive samples per pixel
    void GGLScanLine(const gl_shader_program_t * program, const enum GGLPixelFormat colorFormat,
-                    void * frameBuffer, int * depthBuffer, unsigned char * stencilBuffer,
+                    void * frameBuffer, const enum GGLPixelFormat depthFormat, void * depthBuffer,
+                    const enum GGLPixelFormat stencilFormat, void * stencilBuffer,
                     unsigned bufferWidth, unsigned bufferHeight, GGLActiveStencil_t * activeStencil,
-                    const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4]);
+                    const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4],
+                    const unsigned char * coverage);
 
 //   void GGLProcessFragment(const VertexOutput_t * inputs, VertexOutput_t * outputs,
 //                           const float (*constants[4]));
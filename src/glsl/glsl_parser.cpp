@@ -3500,7 +3500,7 @@ yyreduce:
 			       "only be applied to `int' or `float'\n");
 	      YYERROR;
 	   }
-
+	   if ((yyvsp[(3) - (4)].type_specifier)->type_specifier == ast_float) state->default_float_precision = (yyvsp[(2) - (4)].n);
 	   (yyval.node) = NULL; /* FINISHME */
 	;}
     break;
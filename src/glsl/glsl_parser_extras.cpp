@@ -55,6 +55,7 @@ _mesa_glsl_parse_state::_mesa_glsl_parse_state(const struct gl_context *ctx,
    /* Set default language version and extensions */
    this->language_version = 110;
    this->es_shader = false;
+   this->default_float_precision = 0; /* ast_precision_high */
    this->ARB_texture_rectangle_enable = true;
 
    /* OpenGL ES 2.0 has different defaults from desktop GL. */
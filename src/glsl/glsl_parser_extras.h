@@ -69,6 +69,9 @@ struct _mesa_glsl_parse_state {
 
    bool es_shader;
    unsigned language_version;
+
+   /** ast_precision_* set by the last `precision ... float;' statement */
+   unsigned default_float_precision;
    enum _mesa_glsl_parser_targets target;
 
    /**
@@ -25,7 +25,7 @@
 #include "glsl_types.h"
 #include "glsl_parser_extras.h"
 
-static void print_type(const glsl_type *t);
+static void print_type(FILE *f, const glsl_type *t);
 
 void
 ir_instruction::print(void) const
@@ -38,61 +38,63 @@ ir_instruction::print(void) const
 
 void
 _mesa_print_ir(exec_list *instructions,
-	       struct _mesa_glsl_parse_state *state)
+	       struct _mesa_glsl_parse_state *state, FILE *f)
 {
+   ir_print_visitor v(f);
+
    if (state) {
       for (unsigned i = 0; i < state->num_user_structures; i++) {
 	 const glsl_type *const s = state->user_structures[i];
 
-	 printf("(structure (%s) (%s@%p) (%u) (\n",
+	 fprintf(f, "(structure (%s) (%s@%p) (%u) (\n",
 		s->name, s->name, (void *) s, s->length);
 
 	 for (unsigned j = 0; j < s->length; j++) {
-	    printf("\t((");
-	    print_type(s->fields.structure[j].type);
-	    printf(")(%s))\n", s->fields.structure[j].name);
+	    fprintf(f, "\t((");
+	    print_type(f, s->fields.structure[j].type);
+	    fprintf(f, ")(%s))\n", s->fields.structure[j].name);
 	 }
 
-	 printf(")\n");
+	 fprintf(f, ")\n");
       }
    }
 
-   printf("(\n");
+   fprintf(f, "(\n");
    foreach_iter(exec_list_iterator, iter, *instructions) {
       ir_instruction *ir = (ir_instruction *)iter.get();
-      ir->print();
+      ir->accept(&v);
       if (ir->ir_type != ir_type_function)
-	 printf("\n");
+	 fprintf(f, "\n");
    }
-   printf("\n)");
+   fprintf(f, "\n)");
 }
 
 
 void ir_print_visitor::indent(void)
 {
    for (int i = 0; i < indentation; i++)
-      printf("  ");
+      fprintf(f, "  ");
 }
 
 static void
-print_type(const glsl_type *t)
+print_type(FILE *f, const glsl_type *t)
 {
    if (t->base_type == GLSL_TYPE_ARRAY) {
-      printf("(array ");
-      print_type(t->fields.array);
-      printf(" %u)", t->length);
+      fprintf(f, "(array ");
+      print_type(f, t->fields.array);
+      fprintf(f, " %u)", t->length);
    } else if ((t->base_type == GLSL_TYPE_STRUCT)
 	      && (strncmp("gl_", t->name, 3) != 0)) {
-      printf("%s@%p", t->name, (void *) t);
+      fprintf(f, "%s@%p", t->name, (void *) t);
    } else {
-      printf("%s", t->name);
+      fprintf(f, "%s", t->name);
    }
 }
 
 
 void ir_print_visitor::visit(ir_variable *ir)
 {
-   printf("(declare ");
+   fprintf(f, "(declare ");
 
    const char *const cent = (ir->centroid) ? "centroid " : "";
    const char *const inv = (ir->invariant) ? "invariant " : "";
@@ -100,24 +102,24 @@ void ir_print_visitor::visit(ir_variable *ir)
 			        "temporary " };
    const char *const interp[] = { "", "flat", "noperspective" };
 
-   printf("(%s%s%s%s) ",
+   fprintf(f, "(%s%s%s%s) ",
 	  cent, inv, mode[ir->mode], interp[ir->interpolation]);
 
-   print_type(ir->type);
-   printf(" %s@%p)", ir->name, (void *) ir);
+   print_type(f, ir->type);
+   fprintf(f, " %s@%p)", ir->name, (void *) ir);
 }
 
 
 void ir_print_visitor::visit(ir_function_signature *ir)
 {
-   printf("(signature ");
+   fprintf(f, "(signature ");
    indentation++;
 
-   print_type(ir->return_type);
-   printf("\n");
+   print_type(f, ir->return_type);
+   fprintf(f, "\n");
    indent();
 
-   printf("(parameters\n");
+   fprintf(f, "(parameters\n");
    indentation++;
 
    foreach_iter(exec_list_iterator, iter, ir->parameters) {
@@ -125,16 +127,16 @@ void ir_print_visitor::visit(ir_function_signature *ir)
 
       indent();
       inst->accept(this);
-      printf("\n");
+      fprintf(f, "\n");
    }
    indentation--;
 
    indent();
-   printf(")\n");
+   fprintf(f, ")\n");
 
    indent();
 
-   printf("(\n");
+   fprintf(f, "(\n");
    indentation++;
 
    foreach_iter(exec_list_iterator, iter, ir->body) {
@@ -142,73 +144,73 @@ void ir_print_visitor::visit(ir_function_signature *ir)
 
       indent();
       inst->accept(this);
-      printf("\n");
+      fprintf(f, "\n");
    }
    indentation--;
    indent();
-   printf("))\n");
+   fprintf(f, "))\n");
    indentation--;
 }
 
 
 void ir_print_visitor::visit(ir_function *ir)
 {
-   printf("(function %s\n", ir->name);
+   fprintf(f, "(function %s\n", ir->name);
    indentation++;
    foreach_iter(exec_list_iterator, iter, *ir) {
       ir_function_signature *const sig = (ir_function_signature *) iter.get();
       indent();
       sig->accept(this);
-      printf("\n");
+      fprintf(f, "\n");
    }
    indentation--;
    indent();
-   printf(")\n\n");
+   fprintf(f, ")\n\n");
 }
 
 
 void ir_print_visitor::visit(ir_expression *ir)
 {
-   printf("(expression ");
+   fprintf(f, "(expression ");
 
-   print_type(ir->type);
+   print_type(f, ir->type);
 
-   printf(" %s ", ir->operator_string());
+   fprintf(f, " %s ", ir->operator_string());
 
    for (unsigned i = 0; i < ir->get_num_operands(); i++) {
       ir->operands[i]->accept(this);
    }
 
-   printf(") ");
+   fprintf(f, ") ");
 }
 
 
 void ir_print_visitor::visit(ir_texture *ir)
 {
-   printf("(%s ", ir->opcode_string());
+   fprintf(f, "(%s ", ir->opcode_string());
 
    ir->sampler->accept(this);
-   printf(" ");
+   fprintf(f, " ");
 
    ir->coordinate->accept(this);
 
-   printf(" (%d %d %d) ", ir->offsets[0], ir->offsets[1], ir->offsets[2]);
+   fprintf(f, " (%d %d %d) ", ir->offsets[0], ir->offsets[1], ir->offsets[2]);
 
    if (ir->op != ir_txf) {
       if (ir->projector)
 	 ir->projector->accept(this);
       else
-	 printf("1");
+	 fprintf(f, "1");
 
       if (ir->shadow_comparitor) {
-	 printf(" ");
+	 fprintf(f, " ");
 	 ir->shadow_comparitor->accept(this);
       } else {
-	 printf(" ()");
+	 fprintf(f, " ()");
       }
    }
 
-   printf(" ");
+   fprintf(f, " ");
    switch (ir->op)
    {
    case ir_tex:
@@ -221,14 +223,14 @@ void ir_print_visitor::visit(ir_texture *ir)
       ir->lod_info.lod->accept(this);
       break;
    case ir_txd:
-      printf("(");
+      fprintf(f, "(");
       ir->lod_info.grad.dPdx->accept(this);
-      printf(" ");
+      fprintf(f, " ");
       ir->lod_info.grad.dPdy->accept(this);
-      printf(")");
+      fprintf(f, ")");
       break;
    };
-   printf(")");
+   fprintf(f, ")");
 }
 
 
@@ -241,48 +243,48 @@ void ir_print_visitor::visit(ir_swizzle *ir)
       ir->mask.w,
    };
 
-   printf("(swiz ");
+   fprintf(f, "(swiz ");
    for (unsigned i = 0; i < ir->mask.num_components; i++) {
-      printf("%c", "xyzw"[swiz[i]]);
+      fprintf(f, "%c", "xyzw"[swiz[i]]);
    }
-   printf(" ");
+   fprintf(f, " ");
    ir->val->accept(this);
-   printf(")");
+   fprintf(f, ")");
 }
 
 
 void ir_print_visitor::visit(ir_dereference_variable *ir)
 {
    ir_variable *var = ir->variable_referenced();
-   printf("(var_ref %s@%p) ", var->name, (void *) var);
+   fprintf(f, "(var_ref %s@%p) ", var->name, (void *) var);
 }
 
 
 void ir_print_visitor::visit(ir_dereference_array *ir)
 {
-   printf("(array_ref ");
+   fprintf(f, "(array_ref ");
    ir->array->accept(this);
    ir->array_index->accept(this);
-   printf(") ");
+   fprintf(f, ") ");
 }
 
 
 void ir_print_visitor::visit(ir_dereference_record *ir)
 {
-   printf("(record_ref ");
+   fprintf(f, "(record_ref ");
    ir->record->accept(this);
-   printf(" %s) ", ir->field);
+   fprintf(f, " %s) ", ir->field);
 }
 
 
 void ir_print_visitor::visit(ir_assignment *ir)
 {
-   printf("(assign ");
+   fprintf(f, "(assign ");
 
    if (ir->condition)
       ir->condition->accept(this);
    else
-      printf("(constant bool (1))");
+      fprintf(f, "(constant bool (1))");
 
 
    char mask[5];
@@ -296,14 +298,14 @@ void ir_print_visitor::visit(ir_assignment *ir)
    }
    mask[j] = '\0';
 
-   printf(" (%s) ", mask);
+   fprintf(f, " (%s) ", mask);
 
    ir->lhs->accept(this);
 
-   printf(" ");
+   fprintf(f, " ");
 
    ir->rhs->accept(this);
-   printf(") ");
+   fprintf(f, ") ");
 }
 
 
@@ -311,9 +313,9 @@ void ir_print_visitor::visit(ir_constant *ir)
 {
    const glsl_type *const base_type = ir->type->get_base_type();
 
-   printf("(constant ");
-   print_type(ir->type);
-   printf(" (");
+   fprintf(f, "(constant ");
+   print_type(f, ir->type);
+   fprintf(f, " (");
 
    if (ir->type->is_array()) {
       for (unsigned i = 0; i < ir->type->length; i++)
@@ -321,78 +323,78 @@ void ir_print_visitor::visit(ir_constant *ir)
    } else if (ir->type->is_record()) {
       ir_constant *value = (ir_constant *) ir->components.get_head();
       for (unsigned i = 0; i < ir->type->length; i++) {
-	 printf("(%s ", ir->type->fields.structure->name);
+	 fprintf(f, "(%s ", ir->type->fields.structure->name);
 	 value->accept(this);
-	 printf(")");
+	 fprintf(f, ")");
 
 	 value = (ir_constant *) value->next;
       }
    } else {
       for (unsigned i = 0; i < ir->type->components(); i++) {
 	 if (i != 0)
-	    printf(" ");
+	    fprintf(f, " ");
 	 switch (base_type->base_type) {
-	 case GLSL_TYPE_UINT:  printf("%u", ir->value.u[i]); break;
-	 case GLSL_TYPE_INT:   printf("%d", ir->value.i[i]); break;
-	 case GLSL_TYPE_FLOAT: printf("%f", ir->value.f[i]); break;
-	 case GLSL_TYPE_BOOL:  printf("%d", ir->value.b[i]); break;
+	 case GLSL_TYPE_UINT:  fprintf(f, "%u", ir->value.u[i]); break;
+	 case GLSL_TYPE_INT:   fprintf(f, "%d", ir->value.i[i]); break;
+	 case GLSL_TYPE_FLOAT: fprintf(f, "%f", ir->value.f[i]); break;
+	 case GLSL_TYPE_BOOL:  fprintf(f, "%d", ir->value.b[i]); break;
 	 default: assert(0);
 	 }
       }
    }
-   printf(")) ");
+   fprintf(f, ")) ");
 }
 
 
 void
 ir_print_visitor::visit(ir_call *ir)
 {
-   printf("(call %s (", ir->callee_name());
+   fprintf(f, "(call %s (", ir->callee_name());
    foreach_iter(exec_list_iterator, iter, *ir) {
       ir_instruction *const inst = (ir_instruction *) iter.get();
 
       inst->accept(this);
    }
-   printf("))\n");
+   fprintf(f, "))\n");
 }
 
 
 void
 ir_print_visitor::visit(ir_return *ir)
 {
-   printf("(return");
+   fprintf(f, "(return");
 
    ir_rvalue *const value = ir->get_value();
    if (value) {
-      printf(" ");
+      fprintf(f, " ");
       value->accept(this);
    }
 
-   printf(")");
+   fprintf(f, ")");
 }
 
 
 void
 ir_print_visitor::visit(ir_discard *ir)
 {
-   printf("(discard ");
+   fprintf(f, "(discard ");
 
    if (ir->condition != NULL) {
-      printf(" ");
+      fprintf(f, " ");
       ir->condition->accept(this);
    }
 
-   printf(")");
+   fprintf(f, ")");
 }
 
 
 void
 ir_print_visitor::visit(ir_if *ir)
 {
-   printf("(if ");
+   fprintf(f, "(if ");
    ir->condition->accept(this);
 
-   printf("(\n");
+   fprintf(f, "(\n");
    indentation++;
 
    foreach_iter(exec_list_iterator, iter, ir->then_instructions) {
@@ -400,16 +402,16 @@ ir_print_visitor::visit(ir_if *ir)
 
       indent();
       inst->accept(this);
-      printf("\n");
+      fprintf(f, "\n");
    }
 
    indentation--;
    indent();
-   printf(")\n");
+   fprintf(f, ")\n");
 
    indent();
    if (!ir->else_instructions.is_empty()) {
-      printf("(\n");
+      fprintf(f, "(\n");
       indentation++;
 
       foreach_iter(exec_list_iterator, iter, ir->else_instructions) {
@@ -417,13 +419,13 @@ ir_print_visitor::visit(ir_if *ir)
 
 	 indent();
 	 inst->accept(this);
-	 printf("\n");
+	 fprintf(f, "\n");
       }
       indentation--;
       indent();
-      printf("))\n");
+      fprintf(f, "))\n");
    } else {
-      printf("())\n");
+      fprintf(f, "())\n");
    }
 }
 
@@ -431,19 +433,19 @@ ir_print_visitor::visit(ir_if *ir)
 void
 ir_print_visitor::visit(ir_loop *ir)
 {
-   printf("(loop (");
+   fprintf(f, "(loop (");
    if (ir->counter != NULL)
       ir->counter->accept(this);
-   printf(") (");
+   fprintf(f, ") (");
    if (ir->from != NULL)
       ir->from->accept(this);
-   printf(") (");
+   fprintf(f, ") (");
    if (ir->to != NULL)
       ir->to->accept(this);
-   printf(") (");
+   fprintf(f, ") (");
    if (ir->increment != NULL)
       ir->increment->accept(this);
-   printf(") (\n");
+   fprintf(f, ") (\n");
    indentation++;
 
    foreach_iter(exec_list_iterator, iter, ir->body_instructions) {
@@ -451,16 +453,16 @@ ir_print_visitor::visit(ir_loop *ir)
 
       indent();
       inst->accept(this);
-      printf("\n");
+      fprintf(f, "\n");
    }
    indentation--;
    indent();
-   printf("))\n");
+   fprintf(f, "))\n");
 }
 
 
 void
 ir_print_visitor::visit(ir_loop_jump *ir)
 {
-   printf("%s", ir->is_break() ? "break" : "continue");
+   fprintf(f, "%s", ir->is_break() ? "break" : "continue");
 }
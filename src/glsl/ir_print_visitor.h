@@ -26,20 +26,24 @@
 #ifndef IR_PRINT_VISITOR_H
 #define IR_PRINT_VISITOR_H
 
+#include <stdio.h>
+
 #include "ir.h"
 #include "ir_visitor.h"
 
 extern void _mesa_print_ir(exec_list *instructions,
-			   struct _mesa_glsl_parse_state *state);
+			   struct _mesa_glsl_parse_state *state,
+			   FILE *f = stdout);
 
 /**
  * Abstract base class of visitors of IR instruction trees
  */
 class ir_print_visitor : public ir_visitor {
 public:
-   ir_print_visitor()
+   ir_print_visitor(FILE *f = stdout)
    {
       indentation = 0;
+      this->f = f;
    }
 
    virtual ~ir_print_visitor()
@@ -78,6 +82,7 @@ public:
 
 private:
    int indentation;
+   FILE *f; /**< stream the IR is printed to */
 };
 
 #endif /* IR_PRINT_VISITOR_H */
@@ -41,11 +41,13 @@
 #include "llvm/LLVMContext.h"
 #include "llvm/Module.h"
 #include "llvm/Analysis/Verifier.h"
-//#include "llvm/Intrinsics.h"
+#include "llvm/Intrinsics.h"
 
 #include <vector>
 #include <stdio.h>
+#include <math.h>
 #include <map>
+#include <string>
 /*
 #ifdef _MSC_VER
 #include <unordered_map>
@@ -59,10 +61,14 @@ using namespace tr1;
 }
 //*/
 
+#include <pixelflinger2/pixelflinger2_interface.h>
+
 #include "ir.h"
 #include "ir_visitor.h"
 #include "glsl_types.h"
 #include "src/mesa/main/mtypes.h"
+#include "src/mesa/program/prog_uniform.h"
+#include "ast.h"
 
 // Helper function to convert array to llvm::ArrayRef
 template <typename T, size_t N>
@@ -79,9 +85,11 @@ static inline llvm::ArrayRef<T> pack(T const *ptr, size_t n) {
 struct GGLState;
 
 llvm::Value * tex2D(llvm::IRBuilder<> & builder, llvm::Value * in1, const unsigned sampler,
-                     const GGLState * gglCtx);
+                     const GGLState * gglCtx, llvm::Value * lod, llvm::Value * dPdx,
+                     llvm::Value * dPdy);
 llvm::Value * texCube(llvm::IRBuilder<> & builder, llvm::Value * in1, const unsigned sampler,
-                     const GGLState * gglCtx);
+                     const GGLState * gglCtx, llvm::Value * lod, llvm::Value * dPdx,
+                     llvm::Value * dPdy);
 
 class ir_to_llvm_visitor : public ir_visitor {
    ir_to_llvm_visitor();
@@ -99,28 +107,19 @@ public:
 
    const GGLState * gglCtx;
    const char * shaderSuffix;
-   llvm::Value * inputsPtr, * outputsPtr, * constantsPtr; // internal globals to store inputs/outputs/constants pointers
+   bool fastMath; // lower precision transcendental kernels for mediump/lowp shaders
+   // inputs/outputs/constants pointers, arguments of every function so they stay in registers
    llvm::Value * inputs, * outputs, * constants;
+   bool isMain; // visiting main, where discard returns
+   const gl_uniform_list * uniforms;
 
-   ir_to_llvm_visitor(llvm::Module* p_mod, const GGLState * GGLCtx, const char * suffix)
+   ir_to_llvm_visitor(llvm::Module* p_mod, const GGLState * GGLCtx, const char * suffix,
+                      const unsigned floatPrecision, const gl_uniform_list * uniformList)
    : ctx(p_mod->getContext()), mod(p_mod), fun(0), loop(std::make_pair((llvm::BasicBlock*)0,
       (llvm::BasicBlock*)0)), bb(0), bld(ctx), gglCtx(GGLCtx), shaderSuffix(suffix),
-      inputsPtr(NULL), outputsPtr(NULL), constantsPtr(NULL),
-      inputs(NULL), outputs(NULL), constants(NULL)
+      fastMath(ast_precision_high != floatPrecision),
+      inputs(NULL), outputs(NULL), constants(NULL), isMain(false), uniforms(uniformList)
    {
-      llvm::PointerType * const floatVecPtrType = llvm::PointerType::get(llvm::VectorType::get(bld.getFloatTy(),4), 0);
-      llvm::Constant * const nullFloatVecPtr = llvm::Constant::getNullValue(floatVecPtrType);
-      // make input, output and consts global pointers so they can be used in
-      // different LLVM functions since the shader shares these "registers" across "functions"
-
-      inputsPtr = new llvm::GlobalVariable(*mod, floatVecPtrType, false,
-         llvm::GlobalValue::InternalLinkage, nullFloatVecPtr, "gl_inputPtr");
-
-      outputsPtr = new llvm::GlobalVariable(*mod, floatVecPtrType, false,
-         llvm::GlobalValue::InternalLinkage, nullFloatVecPtr, "gl_outputsPtr");
-
-      constantsPtr = new llvm::GlobalVariable(*mod, floatVecPtrType, false,
-         llvm::GlobalValue::InternalLinkage, nullFloatVecPtr, "gl_constantsPtr");
    }
 
    llvm::Type* llvm_base_type(unsigned base_type)
@@ -289,15 +288,16 @@ public:
          if(!strcmp(name, "main") || !sig->is_defined)
          {
             linkage = llvm::Function::ExternalLinkage;
-            llvm::PointerType * vecPtrTy = llvm::PointerType::get(llvm::VectorType::get(bld.getFloatTy(), 4), 0);
             assert(0 == params.size());
-            params.push_back(vecPtrTy); // inputs
-            params.push_back(vecPtrTy); // outputs
-            params.push_back(vecPtrTy); // constants
          }
          else {
             linkage = llvm::Function::InternalLinkage;
          }
+         // the shader shares these "registers" across "functions", so they follow the parameters
+         llvm::PointerType * vecPtrTy = llvm::PointerType::get(llvm::VectorType::get(bld.getFloatTy(), 4), 0);
+         params.push_back(vecPtrTy); // inputs
+         params.push_back(vecPtrTy); // outputs
+         params.push_back(vecPtrTy); // constants
          llvm::FunctionType* ft = llvm::FunctionType::get(llvm_type(sig->return_type),
                                                           llvm::ArrayRef<llvm::Type*>(params),
                                                           false);
@@ -348,75 +348,163 @@ public:
       }
    }
 
-//   llvm::Value* llvm_intrinsic(llvm::Intrinsic::ID id, llvm::Value* a)
-//   {
-//      llvm::Type* types[1] = {a->getType()};
-//      return bld.CreateCall(llvm::Intrinsic::getDeclaration(mod, id, types, 1), a);
-//   }
-//
-//   llvm::Value* llvm_intrinsic(llvm::Intrinsic::ID id, llvm::Value* a, llvm::Value* b)
-//   {
-//      llvm::Type* types[2] = {a->getType(), b->getType()};
-//      /* only one type suffix is usually needed, so pass 1 here */
-//      return bld.CreateCall2(llvm::Intrinsic::getDeclaration(mod, id, types, 1), a, b);
-//   }
+   llvm::Value* llvm_intrinsic(llvm::Intrinsic::ID id, llvm::Value* a)
+   {
+      llvm::Type* types[1] = {a->getType()};
+      return bld.CreateCall(llvm::Intrinsic::getDeclaration(mod, id, pack(types)), a);
+   }
+
+   llvm::Value* llvm_intrinsic(llvm::Intrinsic::ID id, llvm::Value* a, llvm::Value* b, llvm::Value* c)
+   {
+      llvm::Type* types[1] = {a->getType()};
+      llvm::Value* args[3] = {a, b, c};
+      return bld.CreateCall(llvm::Intrinsic::getDeclaration(mod, id, pack(types)), pack(args));
+   }
+
+   // integer type with the same number of elements as float scalar or vector type
+   llvm::Type* llvm_int_type(llvm::Type* type)
+   {
+      if (type->isVectorTy())
+         return llvm::VectorType::get(bld.getInt32Ty(), ((llvm::VectorType*)type)->getNumElements());
+      return bld.getInt32Ty();
+   }
+
+   // Horner evaluation of coeffs[0] + coeffs[1] * x + ...
+   llvm::Value* create_poly(llvm::Value* x, const float * coeffs, unsigned count)
+   {
+      llvm::Value* poly = llvm_imm(x->getType(), coeffs[count - 1]);
+      for (int i = count - 2; i >= 0; i--)
+         poly = bld.CreateFAdd(bld.CreateFMul(poly, x), llvm_imm(x->getType(), coeffs[i]), "poly");
+      return poly;
+   }
 
+   llvm::Value* create_floor(llvm::Value* x)
+   {
+      llvm::Value* trunc = bld.CreateSIToFP(bld.CreateFPToSI(x, llvm_int_type(x->getType())),
+                                            x->getType(), "floor.trunc");
+      // truncation rounds negative values up
+      llvm::Value* adjust = bld.CreateUIToFP(bld.CreateFCmpOGT(trunc, x), x->getType());
+      return bld.CreateFSub(trunc, adjust, "floor");
+   }
+
+   // 2^x as 2^floor(x) built in the exponent bits times a polynomial for 2^fract(x)
+   llvm::Value* create_exp2(llvm::Value* x)
+   {
+      static const float full[] = {1, 0.6931514f, 0.2401642f, 0.05580045f, 0.009016687f, 0.001867183f};
+      static const float fast[] = {1, 0.6951229f, 0.2276456f, 0.07705805f};
+      llvm::Type* type = x->getType();
+      llvm::Value* bound = llvm_imm(type, -126);
+      x = bld.CreateSelect(bld.CreateFCmpOGE(x, bound), x, bound);
+      bound = llvm_imm(type, 127.99998f);
+      x = bld.CreateSelect(bld.CreateFCmpOLE(x, bound), x, bound, "exp2.clamp");
+      llvm::Value* whole = create_floor(x);
+      llvm::Value* poly = fastMath ? create_poly(bld.CreateFSub(x, whole), fast, 4) :
+                          create_poly(bld.CreateFSub(x, whole), full, 6);
+      llvm::Value* exponent = bld.CreateFPToSI(whole, llvm_int_type(type));
+      exponent = bld.CreateShl(bld.CreateAdd(exponent, llvm_imm(exponent->getType(), 127)),
+                               llvm_imm(exponent->getType(), 23));
+      return bld.CreateFMul(poly, bld.CreateBitCast(exponent, type), "exp2");
+   }
+
+   // exponent plus 2/ln2 * atanh series of the mantissa in [sqrt(0.5), sqrt(2)]
+   llvm::Value* create_log2(llvm::Value* x)
+   {
+      static const float full[] = {2.8853901f, 0.9617967f, 0.5770780f, 0.4121986f};
+      static const float fast[] = {2.8853901f, 0.9617967f};
+      llvm::Type* type = x->getType();
+      llvm::Type* intType = llvm_int_type(type);
+      llvm::Value* bits = bld.CreateBitCast(x, intType);
+      llvm::Value* exponent = bld.CreateSub(bld.CreateLShr(bits, llvm_imm(intType, 23)),
+                                            llvm_imm(intType, 127));
+      llvm::Value* mantissa = bld.CreateOr(bld.CreateAnd(bits, llvm_imm(intType, 0x007fffff)),
+                                           llvm_imm(intType, 0x3f800000));
+      mantissa = bld.CreateBitCast(mantissa, type);
+      llvm::Value* big = bld.CreateFCmpOGT(mantissa, llvm_imm(type, 1.41421356f));
+      mantissa = bld.CreateSelect(big, bld.CreateFMul(mantissa, llvm_imm(type, 0.5f)), mantissa);
+      llvm::Value* whole = bld.CreateFAdd(bld.CreateSIToFP(exponent, type),
+                                          bld.CreateUIToFP(big, type));
+      llvm::Value* one = llvm_imm(type, 1);
+      llvm::Value* t = bld.CreateFDiv(bld.CreateFSub(mantissa, one), bld.CreateFAdd(mantissa, one));
+      llvm::Value* poly = fastMath ? create_poly(bld.CreateFMul(t, t), fast, 2) :
+                          create_poly(bld.CreateFMul(t, t), full, 4);
+      return bld.CreateFAdd(whole, bld.CreateFMul(t, poly), "log2");
+   }
+
+   // sin(x) = (-1)^n * sin(x - n * pi), with the remainder in [-pi/2, pi/2]
+   llvm::Value* create_sin(llvm::Value* x)
+   {
+      static const float full[] = {1, -0.1666666f, 0.008333062f, -0.0001980935f, 2.605294e-06f};
+      static const float fast[] = {1, -0.1661198f, 0.007652262f};
+      llvm::Type* type = x->getType();
+      llvm::Type* intType = llvm_int_type(type);
+      llvm::Value* n = create_floor(bld.CreateFAdd(bld.CreateFMul(x, llvm_imm(type, 1 / M_PI)),
+                                                   llvm_imm(type, 0.5)));
+      // pi split so n * 3.140625 is exact
+      llvm::Value* r = bld.CreateFSub(x, bld.CreateFMul(n, llvm_imm(type, 3.140625)));
+      r = bld.CreateFSub(r, bld.CreateFMul(n, llvm_imm(type, M_PI - 3.140625)), "sin.reduced");
+      llvm::Value* r2 = bld.CreateFMul(r, r);
+      llvm::Value* poly = bld.CreateFMul(r, fastMath ? create_poly(r2, fast, 3) :
+                                         create_poly(r2, full, 5));
+      llvm::Value* sign = bld.CreateAnd(bld.CreateFPToSI(n, intType), llvm_imm(intType, 1));
+      sign = bld.CreateShl(sign, llvm_imm(intType, 31));
+      return bld.CreateBitCast(bld.CreateXor(bld.CreateBitCast(poly, intType), sign), type, "sin");
+   }
+
+   llvm::Value* create_rsq(llvm::Value* x)
+   {
+      llvm::Type* type = x->getType();
+      // initial estimate from the exponent bits, then Newton steps, avoiding sqrt and
+      // fdiv that NEON does not vectorize; the third step brings it to full float precision
+      llvm::Type* intType = llvm_int_type(type);
+      llvm::Value* y = bld.CreateSub(llvm_imm(intType, 0x5f3759df),
+                                     bld.CreateLShr(bld.CreateBitCast(x, intType), llvm_imm(intType, 1)));
+      y = bld.CreateBitCast(y, type);
+      llvm::Value* half = bld.CreateFMul(x, llvm_imm(type, 0.5f));
+      for (unsigned i = 0; i < (fastMath ? 2 : 3); i++) {
+         llvm::Value* step = bld.CreateFSub(llvm_imm(type, 1.5f), bld.CreateFMul(half, bld.CreateFMul(y, y)));
+         y = bld.CreateFMul(y, step, "rsqrt.newton");
+      }
+      return y;
+   }
+
+   // inline kernels operate on float scalars and vectors alike
    llvm::Value* llvm_intrinsic_unop(ir_expression_operation op, llvm::Value * op0)
    {
-      llvm::Type * floatType = llvm::Type::getFloatTy(ctx);
-      const char * name = NULL;
+      llvm::Type * type = op0->getType();
       switch (op) {
+      case ir_unop_exp:
+         return create_exp2(bld.CreateFMul(op0, llvm_imm(type, M_LOG2E)));
+      case ir_unop_exp2:
+         return create_exp2(op0);
+      case ir_unop_log:
+         return bld.CreateFMul(create_log2(op0), llvm_imm(type, M_LN2));
+      case ir_unop_log2:
+         return create_log2(op0);
       case ir_unop_sin:
-         name = "sinf";
-         break;
+         return create_sin(op0);
       case ir_unop_cos:
-         name = "cosf";
-         break;
+         return create_sin(bld.CreateFAdd(op0, llvm_imm(type, M_PI_2)));
+      case ir_unop_sqrt:
+         if (fastMath)
+            return bld.CreateFMul(op0, create_rsq(op0), "sqrt");
+         return llvm_intrinsic(llvm::Intrinsic::sqrt, op0);
+      case ir_unop_rsq:
+         return create_rsq(op0);
       default:
          assert(0);
+         return NULL;
       }
-
-      llvm::Function * function = mod->getFunction(name);
-      if (!function) {
-         // predeclare the intrinsic
-         std::vector<llvm::Type*> args;
-         args.push_back(floatType);
-         llvm::FunctionType* type = llvm::FunctionType::get(floatType,
-                                                            llvm::ArrayRef<llvm::Type*>(args),
-                                                            false);
-         function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, mod);
-         function->setCallingConv(llvm::CallingConv::C);
-      }
-
-      return bld.CreateCall(function, op0);
    }
 
    llvm::Value* llvm_intrinsic_binop(ir_expression_operation op, llvm::Value * op0, llvm::Value * op1)
    {
-      llvm::Type * floatType = llvm::Type::getFloatTy(ctx);
-      const char * name = NULL;
       switch (op) {
       case ir_binop_pow:
-         name = "powf";
-         break;
+         return create_exp2(bld.CreateFMul(op1, create_log2(op0)));
       default:
          assert(0);
+         return NULL;
       }
-
-      llvm::Function * function = mod->getFunction(name);
-      if (!function) {
-         // predeclare the intrinsic
-         std::vector<llvm::Type*> args;
-         args.push_back(floatType);
-         args.push_back(floatType);
-         llvm::FunctionType* type = llvm::FunctionType::get(floatType,
-                                                            llvm::ArrayRef<llvm::Type*>(args),
-                                                            false);
-         function = llvm::Function::Create(type, llvm::Function::ExternalLinkage, name, mod);
-         function->setCallingConv(llvm::CallingConv::C);
-      }
-
-      return bld.CreateCall2(function, op0, op1);
    }
 
    llvm::Constant* llvm_imm(llvm::Type* type, double v)
@@ -447,21 +535,79 @@ public:
       return bld.CreateShuffleVector(v, llvm::UndefValue::get(v->getType()), llvm::ConstantVector::get(pack(vals)), name);
    }
 
+   // selects with a vector condition are lowered to vbsl instead of per element branches
    llvm::Value* create_select(unsigned width, llvm::Value * cond, llvm::Value * tru, llvm::Value * fal, const char * name = "")
    {
-      if (1 == width)
-         return bld.CreateSelect(cond, tru, fal, name);
-
-      llvm::Type * vectorType = tru->getType();
-      llvm::Value * vector = llvm::Constant::getNullValue(vectorType);
-      for (unsigned int i = 0; i < width; i++) {
-         llvm::Value * c = bld.CreateExtractElement(cond, llvm_int(i));
-         llvm::Value * t = bld.CreateExtractElement(tru, llvm_int(i));
-         llvm::Value * f = bld.CreateExtractElement(fal, llvm_int(i));
-         llvm::Value * v = bld.CreateSelect(c, t, f, name);
-         vector = bld.CreateInsertElement(vector, v, llvm_int(i), "vslct");
+      return bld.CreateSelect(cond, tru, fal, name);
+   }
+
+   // one insert and a shuffle, which is a single vdup, rather than an insert per element
+   llvm::Value* create_splat(llvm::Value* scalar, unsigned width)
+   {
+      llvm::Type* vectorType = llvm::VectorType::get(scalar->getType(), width);
+      llvm::Value* vector = bld.CreateInsertElement(llvm::UndefValue::get(vectorType), scalar,
+                                                    llvm_int(0), "splat.insert");
+      llvm::Type* maskType = llvm::VectorType::get(bld.getInt32Ty(), width);
+      return bld.CreateShuffleVector(vector, llvm::UndefValue::get(vectorType),
+                                     llvm::ConstantAggregateZero::get(maskType), "splat");
+   }
+
+   // value of ir, splatted to width if it is a scalar
+   llvm::Value* llvm_vector(ir_rvalue* ir, unsigned width)
+   {
+      llvm::Value* value = llvm_value(ir);
+      if (width > 1 && ir->type->vector_elements <= 1)
+         return create_splat(value, width);
+      return value;
+   }
+
+   // sums the first width elements by repeatedly adding the upper half onto the lower half
+   llvm::Value* create_horizontal_add(llvm::Value* vector, unsigned width, bool isFloat)
+   {
+      const unsigned count = ((llvm::VectorType*)vector->getType())->getNumElements();
+      llvm::Value* odd = 0; // last elements of odd widths
+      while (width > 1) {
+         if (width & 1) {
+            llvm::Value* elem = bld.CreateExtractElement(vector, llvm_int(--width), "hadd.odd");
+            odd = !odd ? elem : isFloat ? bld.CreateFAdd(odd, elem) : bld.CreateAdd(odd, elem);
+         }
+         width /= 2;
+         std::vector<llvm::Constant*> mask;
+         for (unsigned i = 0; i < count; i++)
+            mask.push_back(i < width ? llvm_int(width + i) : llvm::UndefValue::get(bld.getInt32Ty()));
+         llvm::Value* upper = bld.CreateShuffleVector(vector, llvm::UndefValue::get(vector->getType()),
+                                                      llvm::ConstantVector::get(mask), "hadd.upper");
+         vector = isFloat ? bld.CreateFAdd(vector, upper, "hadd") : bld.CreateAdd(vector, upper, "hadd");
       }
-      return vector;
+      llvm::Value* sum = bld.CreateExtractElement(vector, llvm_int(0), "hadd.sum");
+      if (odd)
+         sum = isFloat ? bld.CreateFAdd(sum, odd, "hadd.sum") : bld.CreateAdd(sum, odd, "hadd.sum");
+      return sum;
+   }
+
+   // a * b + c and a * b - c as llvm.fmuladd, which the backend fuses where the target has vfma
+   llvm::Value* create_fmuladd(ir_expression* ir)
+   {
+      if (GLSL_TYPE_FLOAT != ir->type->base_type || ir->type->is_matrix())
+         return 0;
+      for (unsigned i = 0; i < 2; i++) {
+         ir_expression* mul = ir->operands[i]->as_expression();
+         if (!mul || ir_binop_mul != mul->operation || mul->operands[0]->type->is_matrix() ||
+               mul->operands[1]->type->is_matrix())
+            continue;
+         const unsigned width = ir->type->vector_elements;
+         llvm::Value* a = llvm_vector(mul->operands[0], width);
+         llvm::Value* b = llvm_vector(mul->operands[1], width);
+         llvm::Value* c = llvm_vector(ir->operands[1 - i], width);
+         if (ir_binop_sub == ir->operation) {
+            if (0 == i)
+               c = bld.CreateFNeg(c, "fms.neg");
+            else
+               a = bld.CreateFNeg(a, "fms.neg");
+         }
+         return llvm_intrinsic(llvm::Intrinsic::fmuladd, a, b, c);
+      }
+      return 0;
    }
 
    llvm::Value* create_dot_product(llvm::Value* ops0, llvm::Value* ops1, glsl_base_type type, unsigned width)
@@ -481,24 +627,15 @@ public:
 
       if (width<= 1)
          return prod;
-
-      llvm::Value* sum = 0;
-      for (unsigned i = 0; i < width; ++i) {
-         llvm::Value* elem = bld.CreateExtractElement(prod, llvm_int(i), "dot.elem");
-         if (sum) {
-            if (type == GLSL_TYPE_FLOAT)
-               sum = bld.CreateFAdd(sum, elem, "dot.add");
-            else
-               sum = bld.CreateAdd(sum, elem, "dot.add");
-         }
-         else
-            sum = elem;
-      }
-      return sum;
+      return create_horizontal_add(prod, width, GLSL_TYPE_FLOAT == type);
    }
 
    llvm::Value* llvm_expression(ir_expression* ir)
    {
+      if (ir_binop_add == ir->operation || ir_binop_sub == ir->operation)
+         if (llvm::Value* fma = create_fmuladd(ir))
+            return fma;
+
       llvm::Value* ops[2];
       for(unsigned i = 0; i < ir->get_num_operands(); ++i)
          ops[i] = llvm_value(ir->operands[i]);
@@ -521,13 +658,7 @@ public:
             assert(ir->operands[0]->type->vector_elements == ir->operands[1]->type->vector_elements);
 
          if(scaidx >= 0)
-         {
-            llvm::Value* vec;
-            vec = llvm::UndefValue::get(ops[vecidx]->getType());
-            for(unsigned i = 0; i < ir->operands[vecidx]->type->vector_elements; ++i)
-               vec = bld.CreateInsertElement(vec,  ops[scaidx], llvm_int(i), "sca2vec");
-            ops[scaidx] = vec;
-         }
+            ops[scaidx] = create_splat(ops[scaidx], ir->operands[vecidx]->type->vector_elements);
       }
 
       switch (ir->operation) {
@@ -783,7 +914,7 @@ public:
          return llvm_intrinsic_unop(ir->operation, ops[0]);
       case ir_unop_rsq:
          assert(ir->operands[0]->type->base_type == GLSL_TYPE_FLOAT);
-         return bld.CreateFDiv(llvm_imm(ops[0]->getType(), 1), llvm_intrinsic_unop(ir_unop_sqrt, ops[0]), "rsqrt.rcp");
+         return llvm_intrinsic_unop(ir->operation, ops[0]);
       case ir_unop_i2f:
          return bld.CreateSIToFP(ops[0], llvm_type(ir->type));
       case ir_unop_u2f:
@@ -916,6 +1047,62 @@ public:
       result = bld.CreateLoad(llvm_pointer(ir), ir->variable_referenced()->name);
    }
 
+   // uniform name of a dereference, as the linker names struct fields and struct array elements
+   void uniform_name(ir_dereference * deref, std::string & name)
+   {
+      if (ir_dereference_variable * var = deref->as_dereference_variable())
+         name = var->variable_referenced()->name;
+      else if (ir_dereference_record * record = deref->as_dereference_record()) {
+         uniform_name(record->record->as_dereference(), name);
+         name += '.';
+         name += record->field;
+      } else if (ir_dereference_array * array = deref->as_dereference_array()) {
+         ir_constant * index = array->array_index->as_constant();
+         assert(index); // only sampler arrays are indexed dynamically
+         uniform_name(array->array->as_dereference(), name);
+         char element[16];
+         snprintf(element, sizeof(element), "[%d]", index ? index->value.i[0] : 0);
+         name += element;
+      } else
+         assert(0);
+   }
+
+   // first sampler unit of a sampler dereference; a sampler array indexed by a non constant
+   // sets index to the element and count to the array length
+   int sampler_unit(ir_dereference * deref, llvm::Value ** index, unsigned * count)
+   {
+      if (ir_dereference_variable * var = deref->as_dereference_variable())
+         return var->variable_referenced()->location;
+      if (ir_dereference_array * array = deref->as_dereference_array())
+         if (array->array->type->fields.array->is_sampler()) {
+            const int first = sampler_unit(array->array->as_dereference(), index, count);
+            if (ir_constant * element = array->array_index->as_constant())
+               return first + element->value.i[0];
+            *index = llvm_value(array->array_index);
+            *count = array->array->type->length;
+            return first;
+         }
+      // struct fields and struct array elements are uniforms of their own
+      std::string name;
+      uniform_name(deref, name);
+      for (unsigned i = 0; i < uniforms->NumUniforms; i++)
+         if (!strcmp(uniforms->Uniforms[i].Name, name.c_str()))
+            return uniforms->Uniforms[i].Pos;
+      assert(!"sampler uniform not found");
+      return -1;
+   }
+
+   llvm::Value * texture_sample(const glsl_type * type, const unsigned unit, llvm::Value * coordinate,
+                                llvm::Value * lod, llvm::Value * dPdx, llvm::Value * dPdy)
+   {
+      if (GLSL_SAMPLER_DIM_CUBE == type->sampler_dimensionality)
+         return texCube(bld, coordinate, unit, gglCtx, lod, dPdx, dPdy);
+      else if (GLSL_SAMPLER_DIM_2D == type->sampler_dimensionality)
+         return tex2D(bld, coordinate, unit, gglCtx, lod, dPdx, dPdy);
+      assert(0);
+      return NULL;
+   }
+
    virtual void visit(class ir_texture * ir)
    {
       llvm::Value * coordinate = llvm_value(ir->coordinate);
@@ -923,48 +1110,66 @@ public:
       {
          llvm::Value * proj = llvm_value(ir->projector);
          unsigned width = ((llvm::VectorType*)coordinate->getType())->getNumElements();
-         llvm::Value * div = llvm::Constant::getNullValue(coordinate->getType());
-         for (unsigned i = 0; i < width; i++)
-            div = bld.CreateInsertElement(div, proj, bld.getInt32(i), "texProjDup");
-         coordinate = bld.CreateFDiv(coordinate, div, "texProj");
+         coordinate = bld.CreateFDiv(coordinate, create_splat(proj, width), "texProj");
       }
 
-      ir_variable * sampler = NULL;
-      if(ir_dereference_variable* deref = ir->sampler->as_dereference_variable())
-         sampler = deref->variable_referenced();
-      else if(ir_dereference_array* deref = ir->sampler->as_dereference_array())
-      {
-         assert(0); // not implemented
-         return;
-         deref->array_index;
-         deref->array;
-      }
-      else if(ir->sampler->as_dereference())
-      {
-         assert(0); // not implemented
-         ir_dereference_record* deref = (ir_dereference_record*)ir->sampler;
-         int idx = deref->record->type->field_index(deref->field);
-         assert(idx >= 0);
+      llvm::Value * index = NULL;
+      unsigned count = 1;
+      const int unit = sampler_unit(ir->sampler, &index, &count);
+      assert(unit >= 0 && unit + count <= GGL_MAXCOMBINEDTEXTUREIMAGEUNITS);
+
+      // there are no derivatives in the scanline, so the implicit LOD is the base level,
+      // which ir_tex samples and to which the bias of ir_txb is added
+      llvm::Value * lod = NULL, * dPdx = NULL, * dPdy = NULL;
+      switch (ir->op) {
+      case ir_tex:
+         break;
+      case ir_txb:
+         lod = llvm_value(ir->lod_info.bias);
+         break;
+      case ir_txl:
+         lod = llvm_value(ir->lod_info.lod);
+         break;
+      case ir_txd:
+         dPdx = llvm_value(ir->lod_info.grad.dPdx);
+         dPdy = llvm_value(ir->lod_info.grad.dPdy);
+         break;
+      default:
+         assert(!"unsupported texture op");
+         break;
       }
-      else
-         assert(0);
 
-      assert(sampler->location >= 0 && sampler->location < 64); // TODO: proper limit
+      const glsl_type * type = ir->sampler->type;
+      assert(GLSL_TYPE_FLOAT == type->sampler_type);
+      if (!index) {
+         result = texture_sample(type, unit, coordinate, lod, dPdx, dPdy);
+         return;
+      }
 
-      // ESSL texture LOD is only for 2D texture in vert shader, and it's explicit
-      // bias used only in frag shader, and added to computed LOD
-      assert(ir_tex == ir->op);
+      // per pixel switch, since format, wrap and filter of each unit are compiled in;
+      // out of range indices are undefined, and sample the first element
+      std::vector<llvm::BasicBlock *> cases(count);
+      for (unsigned i = 0; i < count; i++)
+         cases[i] = llvm::BasicBlock::Create(ctx, "sampler.case", fun);
+      llvm::BasicBlock * merge = llvm::BasicBlock::Create(ctx, "sampler.merge", fun);
+      llvm::SwitchInst * sw = bld.CreateSwitch(index, cases[0], count - 1);
+      for (unsigned i = 1; i < count; i++)
+         sw->addCase(bld.getInt32(i), cases[i]);
+
+      std::vector<std::pair<llvm::Value *, llvm::BasicBlock *> > texels;
+      for (unsigned i = 0; i < count; i++) {
+         bld.SetInsertPoint(cases[i]);
+         llvm::Value * texel = texture_sample(type, unit + i, coordinate, lod, dPdx, dPdy);
+         texels.push_back(std::make_pair(texel, bld.GetInsertBlock()));
+         bld.CreateBr(merge);
+      }
 
-      assert(GLSL_TYPE_FLOAT == sampler->type->sampler_type);
-      printf("sampler '%s' location=%d dim=%d type=%d proj=%d lod=%d \n", sampler->name, sampler->location,
-         sampler->type->sampler_dimensionality, sampler->type->sampler_type,
-         ir->projector ? 1 : 0, ir->lod_info.lod ? 1 : 0);
-      if (GLSL_SAMPLER_DIM_CUBE == sampler->type->sampler_dimensionality)
-         result = texCube(bld, coordinate, sampler->location, gglCtx);
-      else if (GLSL_SAMPLER_DIM_2D == sampler->type->sampler_dimensionality)
-         result = tex2D(bld, coordinate, sampler->location, gglCtx);
-      else
-         assert(0);
+      bb = merge;
+      bld.SetInsertPoint(bb);
+      llvm::PHINode * phi = bld.CreatePHI(texels[0].first->getType(), count, "sampler.texel");
+      for (unsigned i = 0; i < count; i++)
+         phi->addIncoming(texels[i].first, texels[i].second);
+      result = phi;
    }
 
    virtual void visit(class ir_discard * ir)
@@ -984,18 +1189,15 @@ public:
 
       bld.SetInsertPoint(discard);
 
-      // FIXME: According to the LLVM mailing list, UnwindInst should not
-      // be used by the frontend since LLVM 3.0, and 'CreateUnwind'
-      // method has been removed from the IRBuilder.  Here's the
-      // temporary workaround.  But it would be better to remove
-      // this in the future.
-      //
-      // A solution after LLVM 3.0: To add a global boolean in the shader to
-      // store whether it was discarded or not and just continue on normally,
-      // and handle the discard outside the shader, in the scanline function.
-      // The discard instruction is not used frequently, so it should be okay
-      // performance wise.
-      //new llvm::UnwindInst(ctx, discard); /// Deprecated
+      // the scanline function skips depth, stencil and color writes of discarded fragments
+      llvm::Value* discarded = bld.CreateConstGEP1_32(outputs,
+                               offsetof(VertexOutput, discarded) / sizeof(Vector4));
+      bld.CreateStore(llvm_imm(llvm::VectorType::get(bld.getFloatTy(), 4), 1), discarded);
+      // main ends the fragment; other functions return normally and their results are unused
+      if (isMain)
+         bld.CreateRetVoid();
+      else
+         bld.CreateBr(after);
 
       bb = after;
       bld.SetInsertPoint(bb);
@@ -1122,6 +1324,9 @@ public:
          ir_rvalue *arg = (ir_constant *)iter.get();
          args.push_back(llvm_value(arg));
       }
+      args.push_back(inputs);
+      args.push_back(outputs);
+      args.push_back(constants);
 
       result = bld.CreateCall(llvm_function(ir->get_callee()), llvm::ArrayRef<llvm::Value*>(args));
 
@@ -1335,31 +1540,19 @@ public:
       bld.SetInsertPoint(bb);
 
       llvm::Function::arg_iterator ai = fun->arg_begin();
-      if (!strcmp("main",sig->function_name()))
-      {
-         assert(3 == fun->arg_size());
-         bld.CreateStore(ai, inputsPtr);
-         inputs = ai;
-         ai++;
-         bld.CreateStore(ai, outputsPtr);
-         outputs = ai;
-         ai++;
-         bld.CreateStore(ai, constantsPtr);
-         constants = ai;
-         ai++;
-      }
-      else
-      {
-         foreach_iter(exec_list_iterator, iter, sig->parameters) {
-            ir_variable* arg = (ir_variable*)iter.get();
-            ai->setName(arg->name);
-            bld.CreateStore(ai, llvm_variable(arg));
-            ++ai;
-         }
-         inputs = bld.CreateLoad(inputsPtr);
-         outputs = bld.CreateLoad(outputsPtr);
-         constants = bld.CreateLoad(constantsPtr);
+      isMain = !strcmp("main",sig->function_name());
+      unsigned paramCount = 0;
+      foreach_iter(exec_list_iterator, iter, sig->parameters) {
+         ir_variable* arg = (ir_variable*)iter.get();
+         ai->setName(arg->name);
+         bld.CreateStore(ai, llvm_variable(arg));
+         ++ai;
+         paramCount++;
       }
+      assert(fun->arg_size() == paramCount + 3);
+      inputs = ai++;
+      outputs = ai++;
+      constants = ai++;
       inputs->setName("gl_inputs");
       outputs->setName("gl_outputs");
       constants->setName("gl_constants");
@@ -1393,9 +1586,10 @@ public:
 
 struct llvm::Module *
 glsl_ir_to_llvm_module(struct exec_list *ir, llvm::Module * mod,
-                        const struct GGLState * gglCtx, const char * shaderSuffix)
+                        const struct GGLState * gglCtx, const char * shaderSuffix,
+                        const unsigned floatPrecision, const struct gl_uniform_list * uniforms)
 {
-   ir_to_llvm_visitor v(mod, gglCtx, shaderSuffix);
+   ir_to_llvm_visitor v(mod, gglCtx, shaderSuffix, floatPrecision, uniforms);
 
    visit_exec_list(ir, &v);
 
@@ -4,7 +4,12 @@
 #include "llvm/Module.h"
 #include "ir.h"
 
+struct gl_uniform_list;
+
+// floatPrecision is the ast_precision_* of the shader; mediump and lowp use faster,
+// less accurate transcendental functions; uniforms locate samplers in structs
 struct llvm::Module * glsl_ir_to_llvm_module(struct exec_list *ir, llvm::Module * mod,
-               const struct GGLState * gglCtx, const char * shaderSuffix);
+               const struct GGLState * gglCtx, const char * shaderSuffix,
+               const unsigned floatPrecision, const struct gl_uniform_list * uniforms);
 
 #endif /* IR_TO_LLVM_H_ */
@@ -141,6 +141,29 @@ private:
 };
 
 
+/**
+ * Visitor that determines whether or not a shader contains a discard.
+ */
+class find_discard_visitor : public ir_hierarchical_visitor {
+public:
+   find_discard_visitor()
+      : found(false)
+   {
+      /* empty */
+   }
+
+   using ir_hierarchical_visitor::visit_enter;
+   virtual ir_visitor_status visit_enter(ir_discard *ir)
+   {
+      (void) ir;
+      found = true;
+      return visit_stop;
+   }
+
+   bool found;
+};
+
+
 /**
  * Visitor that determines whether or not a variable is ever read.
  */
@@ -839,6 +862,11 @@ link_intrastage_shaders(void *mem_ctx,
 
    gl_shader *linked = _mesa_new_shader(prog, 0, main->Type);
    linked->ir = new(linked) exec_list;
+   /* Code from every shader is linked in, so use the highest precision. */
+   linked->FloatPrecision = main->FloatPrecision;
+   for (unsigned i = 0; i < num_shaders; i++)
+      linked->FloatPrecision = MIN2(linked->FloatPrecision,
+				    shader_list[i]->FloatPrecision);
    clone_ir_list(mem_ctx, linked->ir, main->ir);
 
    populate_symbol_table(linked);
@@ -1059,7 +1087,7 @@ add_uniform(void *mem_ctx, exec_list *uniforms, struct hash_table *ht,
       }
       
       if (type->is_sampler() || (array_elem_type && array_elem_type->is_sampler()))
-         (*samplers_used) |= 1 << n->u->Pos;
+         (*samplers_used) |= ((1 << n->slots) - 1) << n->u->Pos; // every element of arrays
       index = n->u->Pos;
    }
    return index;
@@ -1394,6 +1422,7 @@ assign_varying_locations(struct gl_shader_program *prog,
    prog->VaryingSlots = 0;
    prog->UsesFragCoord = false;
    prog->UsesPointCoord = false;
+   prog->UsesDiscard = false;
    /* FINISHME: Set dynamically when geometry shader support is added. */
    unsigned output_index = offsetof(VertexOutput,varyings) / sizeof(Vector4); /*VERT_RESULT_VAR0*/;
    unsigned input_index = offsetof(VertexOutput,varyings) / sizeof(Vector4);
@@ -1439,6 +1468,10 @@ assign_varying_locations(struct gl_shader_program *prog,
          var->location = -1;
    }
 
+   find_discard_visitor discard;
+   discard.run(consumer->ir);
+   prog->UsesDiscard = discard.found;
+
    foreach_list(node, producer->ir) {
       ir_variable *const output_var = ((ir_instruction *) node)->as_variable();
 
@@ -2075,6 +2075,7 @@ struct gl_shader
    struct gl_sl_pragmas Pragmas;
 
    unsigned Version;       /**< GLSL version used for linking */
+   unsigned FloatPrecision; /**< default float precision, ast_precision_* */
 
    struct exec_list *ir;
    struct glsl_symbol_table *symbols;
@@ -2084,6 +2085,8 @@ struct gl_shader
    
    struct Executable * executable;
    void (*function)();     /**< the active function */
+   struct Instance * instance; /**< the instance of the active function */
+   unsigned Countdown;     /**< invocations of instance until it is recompiled optimized */
    unsigned SamplersUsed;  /**< bitfield of samplers used by shader */
 };
 
@@ -2147,7 +2150,9 @@ struct gl_shader_program
    
    unsigned AttributeSlots;/**< [0,AttributeSlots-1] read by vertex shader */
    unsigned VaryingSlots;  /**< [0,VaryingSlots-1] read by fragment shader */
-   unsigned UsesFragCoord : 1, UsesPointCoord : 1;
+   unsigned UsesFragCoord : 1, UsesPointCoord : 1, UsesDiscard : 1;
+   unsigned Passes;        /**< GGL_SHADER_PASS_* run on JIT'd modules */
+   const char * DumpDirectory; /**< JIT'd instances are dumped here if not NULL */
 };   
 
 
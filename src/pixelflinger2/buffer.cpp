@@ -19,6 +19,16 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#if defined(__ARM_HAVE_NEON) && USE_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// fills larger than this bypass the cache, since they would evict everything else anyway
+#define GGL_STREAM_FILL_BYTES (256 * 1024)
 
 void SetShaderVerifyFunctions(GGLInterface *);
 
@@ -134,6 +144,208 @@ static void ClearDepthf(GGLInterface * iface, GLclampf d)
    memcpy(&ctx->clearState.depth, &d, sizeof(int)); /*ctx->clearState.depth = (int &)d;*/ // bit reinterpretation
    if (0x80000000 & ctx->clearState.depth) // smaller negative float has bigger int representation, so flip
       ctx->clearState.depth ^= 0x7fffffff; // since -FLT_MAX is close to -1 when bitcasted
+   // same quantization as scanline jit for packed depth stencil
+   ctx->clearState.depth24 = unsigned(MAX2(MIN2(d, 1.0f), 0.0f) * 16777215.0f);
+   ctx->clearState.depth16 = 0x00010001 * unsigned(MAX2(MIN2(d, 1.0f), 0.0f) * 65535.0f);
+}
+
+// pattern is the 32 bit value for 4 byte aligned addresses; 16 and 8 bit values replicated
+// into it stay in phase from any pixel since surfaces are little endian and naturally aligned
+static void Fill(void * dst, const unsigned pattern, unsigned bytes)
+{
+   unsigned char * byte = (unsigned char *)dst;
+   for (; ((uintptr_t)byte & 3) && bytes; bytes--, byte++)
+      *byte = pattern >> (((uintptr_t)byte & 3) * 8);
+   unsigned * word = (unsigned *)byte;
+   for (; ((uintptr_t)word & 15) && bytes >= 4; bytes -= 4)
+      *word++ = pattern;
+#if defined(__ARM_HAVE_NEON) && USE_NEON
+   const uint32x4_t vector = vdupq_n_u32(pattern);
+   for (; bytes >= 32; bytes -= 32, word += 8) {
+      vst1q_u32(word, vector);
+      vst1q_u32(word + 4, vector);
+   }
+#elif defined(__SSE2__)
+   const __m128i vector = _mm_set1_epi32(pattern);
+   if (bytes >= GGL_STREAM_FILL_BYTES) {
+      for (; bytes >= 64; bytes -= 64, word += 16) {
+         _mm_stream_si128((__m128i *)word, vector);
+         _mm_stream_si128((__m128i *)word + 1, vector);
+         _mm_stream_si128((__m128i *)word + 2, vector);
+         _mm_stream_si128((__m128i *)word + 3, vector);
+      }
+      _mm_sfence(); // order streaming stores before following scanline loads
+   }
+   for (; bytes >= 16; bytes -= 16, word += 4)
+      _mm_store_si128((__m128i *)word, vector);
+#endif
+   for (; bytes >= 4; bytes -= 4)
+      *word++ = pattern;
+   for (byte = (unsigned char *)word; bytes; bytes--, byte++)
+      *byte = pattern >> (((uintptr_t)byte & 3) * 8);
+}
+
+// writes only the bits of pattern in mask to each 32 bit pixel
+static void FillMasked(void * dst, const unsigned pattern, const unsigned mask, unsigned bytes)
+{
+   for (unsigned * word = (unsigned *)dst; bytes >= 4; bytes -= 4, word++)
+      *word = (*word & ~mask) | (pattern & mask);
+}
+
+static const GLbitfield clearBits[3] = {GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT,
+                                        GL_STENCIL_BUFFER_BIT
+                                       };
+
+// returns the surface to clear for a buffer bit, or NULL if none is set
+static const GGLSurface * ClearSurface(const GGLContext * ctx, const GLbitfield bit)
+{
+   const GGLSurface * surface = NULL;
+   if (ctx->tile.active) {
+      if (GL_COLOR_BUFFER_BIT == bit)
+         surface = &ctx->tile.frameSurface;
+      else if (GL_DEPTH_BUFFER_BIT == bit)
+         surface = &ctx->tile.depthSurface;
+      else if (GL_STENCIL_BUFFER_BIT == bit)
+         surface = &ctx->tile.stencilSurface;
+   } else if (GL_COLOR_BUFFER_BIT == bit)
+      surface = ctx->multisample.enable ? &ctx->multisample.frameSurface : &ctx->frameSurface;
+   else if (GL_DEPTH_BUFFER_BIT == bit)
+      surface = ctx->multisample.enable ? &ctx->multisample.depthSurface : &ctx->depthSurface;
+   else if (GL_STENCIL_BUFFER_BIT == bit)
+      surface = ctx->multisample.enable ? &ctx->multisample.stencilSurface : &ctx->stencilSurface;
+   return surface && surface->data ? surface : NULL;
+}
+
+// clear value of buffer bit replicated into 32 bits for Fill
+static unsigned ClearPattern(const GGLContext * ctx, const GGLSurface * surface,
+                             const GLbitfield bit)
+{
+   switch (surface->format) {
+   case GGL_PIXEL_FORMAT_RGBA_8888:
+      return ctx->clearState.color;
+   case GGL_PIXEL_FORMAT_BGRA_8888:
+      return (ctx->clearState.color & 0xff00ff00) | ((ctx->clearState.color & 0xff) << 16) |
+             ((ctx->clearState.color >> 16) & 0xff);
+   case GGL_PIXEL_FORMAT_RGBX_8888: // same as scanline jit, x is opaque alpha
+      return ctx->clearState.color | 0xff000000;
+   case GGL_PIXEL_FORMAT_RGB_565: {
+      const unsigned r = ctx->clearState.color & 0xf8, g = ctx->clearState.color & 0xfc00,
+                     b = ctx->clearState.color & 0xf80000;
+      return 0x00010001 * ((r << 8) | (g >> 5) | (b >> 19)); // red in the high bits, like PackRGB565
+   }
+   case GGL_PIXEL_FORMAT_Z_32:
+      return ctx->clearState.depth;
+   case GGL_PIXEL_FORMAT_Z_16:
+      return ctx->clearState.depth16;
+   case GGL_PIXEL_FORMAT_S_8:
+      return ctx->clearState.stencil;
+   case GGL_PIXEL_FORMAT_SZ_24: // depth in low 24 bits, stencil in high 8 bits
+      return GL_DEPTH_BUFFER_BIT == bit ? ctx->clearState.depth24 : ctx->clearState.stencil;
+   default:
+      ALOGD("pf2: ClearPattern format=0x%.02X \n", surface->format);
+      assert(0);
+      return 0;
+   }
+}
+
+struct ClearTarget {
+   const GGLSurface * surface;
+   unsigned pattern, mask; // mask is ~0 unless clearing part of a packed depth stencil surface
+};
+
+// fills targets for the 3 buffer bits in buf with patterns; depth and stencil sharing
+// a SZ_24 surface are merged into the depth target so the surface is written once
+static void ClearTargets(const GGLContext * ctx, const GLbitfield buf,
+                         const unsigned patterns[3], ClearTarget targets[3])
+{
+   for (unsigned i = 0; i < 3; i++) {
+      targets[i].surface = ClearSurface(ctx, clearBits[i] & buf);
+      targets[i].pattern = patterns[i];
+      targets[i].mask = ~0u;
+      if (targets[i].surface && GGL_PIXEL_FORMAT_SZ_24 == targets[i].surface->format)
+         targets[i].mask = GL_DEPTH_BUFFER_BIT == clearBits[i] ? 0x00ffffff : 0xff000000;
+   }
+   ClearTarget & depth = targets[1], & stencil = targets[2];
+   if (depth.surface && stencil.surface && depth.surface->data == stencil.surface->data) {
+      depth.pattern = (depth.pattern & depth.mask) | (stencil.pattern & stencil.mask);
+      depth.mask |= stencil.mask;
+      stencil.surface = NULL;
+   }
+}
+
+static void FillRect(const ClearTarget & target, const unsigned x, const unsigned y,
+                     const unsigned width, const unsigned height)
+{
+   const GGLSurface * surface = target.surface;
+   const unsigned size = PixelFormatSize(surface->format);
+   char * row = (char *)surface->data + (y * surface->width + x) * size;
+   // surfaces are tightly packed, so full width rects are a single fill
+   const unsigned rows = width == surface->width ? 1 : height;
+   const unsigned bytes = width * size * (height / rows);
+   for (unsigned i = 0; i < rows; i++, row += surface->width * size)
+      if (~0u == target.mask)
+         Fill(row, target.pattern, bytes);
+      else
+         FillMasked(row, target.pattern, target.mask, bytes);
+}
+
+// caller holds lazyClear.lock
+static void ResolveTile(const GGLContext * ctx, const unsigned tileX, const unsigned tileY)
+{
+   unsigned char & tag = ctx->lazyClear.tags[tileY * GGL_CLEAR_TILES_PER_ROW + tileX];
+   const unsigned patterns[3] = {ctx->lazyClear.color, ctx->lazyClear.depth,
+                                 ctx->lazyClear.stencil
+                                };
+   GLbitfield buf = 0;
+   for (unsigned i = 0; i < 3; i++)
+      if (tag & (1 << i))
+         buf |= clearBits[i];
+   ClearTarget targets[3];
+   ClearTargets(ctx, buf, patterns, targets);
+   for (unsigned i = 0; i < 3; i++) {
+      const GGLSurface * surface = targets[i].surface;
+      const unsigned x = tileX << GGL_CLEAR_TILE_SHIFT, y = tileY << GGL_CLEAR_TILE_SHIFT;
+      if (!surface || x >= surface->width || y >= surface->height)
+         continue;
+      FillRect(targets[i], x, y, MIN2(1u << GGL_CLEAR_TILE_SHIFT, surface->width - x),
+               MIN2(1u << GGL_CLEAR_TILE_SHIFT, surface->height - y));
+   }
+   tag = 0;
+   ctx->lazyClear.pendingTiles--;
+}
+
+void ResolveLazyClear(const GGLContext * ctx, const unsigned y, const unsigned startX,
+                      const unsigned endX)
+{
+   if (!ctx->lazyClear.pendingTiles)
+      return;
+#if USE_DUAL_THREAD
+   pthread_mutex_lock(&ctx->lazyClear.lock);
+#endif
+   const unsigned char * tags = ctx->lazyClear.tags +
+                                (y >> GGL_CLEAR_TILE_SHIFT) * GGL_CLEAR_TILES_PER_ROW;
+   for (unsigned x = startX >> GGL_CLEAR_TILE_SHIFT; x <= endX >> GGL_CLEAR_TILE_SHIFT; x++)
+      if (tags[x])
+         ResolveTile(ctx, x, y >> GGL_CLEAR_TILE_SHIFT);
+#if USE_DUAL_THREAD
+   pthread_mutex_unlock(&ctx->lazyClear.lock);
+#endif
+}
+
+void ResolveLazyClear(const GGLContext * ctx)
+{
+   if (!ctx->lazyClear.pendingTiles)
+      return;
+#if USE_DUAL_THREAD
+   pthread_mutex_lock(&ctx->lazyClear.lock);
+#endif
+   for (unsigned i = 0; i < GGL_CLEAR_TILES_PER_ROW * GGL_CLEAR_TILES_PER_ROW &&
+         ctx->lazyClear.pendingTiles; i++)
+      if (ctx->lazyClear.tags[i])
+         ResolveTile(ctx, i % GGL_CLEAR_TILES_PER_ROW, i / GGL_CLEAR_TILES_PER_ROW);
+#if USE_DUAL_THREAD
+   pthread_mutex_unlock(&ctx->lazyClear.lock);
+#endif
 }
 
 static void Clear(const GGLInterface * iface, GLbitfield buf)
@@ -141,59 +353,332 @@ static void Clear(const GGLInterface * iface, GLbitfield buf)
    GGL_GET_CONST_CONTEXT(ctx, iface);
 
    // TODO DXL scissor test
-   if (GL_COLOR_BUFFER_BIT & buf && ctx->frameSurface.data) {
-      if (GGL_PIXEL_FORMAT_RGBA_8888 == ctx->frameSurface.format) {
-         unsigned * const end = (unsigned *)ctx->frameSurface.data +
-                                ctx->frameSurface.width * ctx->frameSurface.height;
-         const unsigned color = ctx->clearState.color;
-         for (unsigned * start = (unsigned *)ctx->frameSurface.data; start < end; start++)
-            *start = color;
-      } else if (GGL_PIXEL_FORMAT_RGB_565 == ctx->frameSurface.format) {
-         short * const end = (short *)ctx->frameSurface.data +
-                             ctx->frameSurface.width * ctx->frameSurface.height;
-         unsigned r = ctx->clearState.color & 0xf8, g = ctx->clearState.color & 0xfc00,
-                      b = ctx->clearState.color & 0xf80000;
-         const short color = (b >> 19) | (g >> 5) | (r >> 3);
-         for (short * start = (short *)ctx->frameSurface.data; start < end; start++)
-            *start = color;
-      } else
-         assert(0);
-   }
-   if (GL_DEPTH_BUFFER_BIT & buf && ctx->depthSurface.data) {
-      assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format);
-      unsigned * const end = (unsigned *)ctx->depthSurface.data +
-                             ctx->depthSurface.width * ctx->depthSurface.height;
-      const unsigned depth = ctx->clearState.depth;
-      for (unsigned * start = (unsigned *)ctx->depthSurface.data; start < end; start++)
-         *start = depth;
-   }
-   if (GL_STENCIL_BUFFER_BIT & buf && ctx->stencilSurface.data) {
-      assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format);
-      unsigned * const end = (unsigned *)((unsigned char *)ctx->stencilSurface.data +
-                                          ctx->stencilSurface.width * ctx->stencilSurface.height);
-      unsigned * start = (unsigned *)ctx->stencilSurface.data;
-      const unsigned stencil = ctx->clearState.stencil;
-      for (start; start < end; start++)
-         *start = stencil;
-      start--;
-      for (unsigned char * i = (unsigned char *)start; i < (unsigned char *)end; i++)
-         *i = stencil & 0xff;
+   unsigned patterns[3] = {0, 0, 0};
+   for (unsigned i = 0; i < 3; i++)
+      if (const GGLSurface * surface = ClearSurface(ctx, clearBits[i] & buf))
+         patterns[i] = ClearPattern(ctx, surface, clearBits[i]);
+   ClearTarget targets[3];
+   ClearTargets(ctx, buf, patterns, targets);
+   ctx->tile.invalidated &= ~buf;
+   if (ctx->tile.active) // whole tile buffers are replaced, so they need not be loaded
+      PrepareTile(ctx, 0, buf & (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT));
+   for (unsigned i = 0; i < 3; i++) {
+      const GGLSurface * surface = targets[i].surface;
+      if (!surface)
+         continue;
+      // multisample and tile buffers are not in screen tiles, so they are always filled
+      if (!ctx->lazyClear.enable || ctx->multisample.enable || ctx->tile.active ||
+            surface->width > GGL_MAX_VIEWPORT_DIMS ||
+            surface->height > GGL_MAX_VIEWPORT_DIMS) {
+         FillRect(targets[i], 0, 0, surface->width, surface->height);
+         continue;
+      }
+#if USE_DUAL_THREAD
+      pthread_mutex_lock(&ctx->lazyClear.lock);
+#endif
+      // supersedes tiles tagged by previous Clear; merged targets tag both bits
+      const GLbitfield tagBits = i == 1 && !targets[2].surface && (GL_STENCIL_BUFFER_BIT & buf) ?
+                                 (1 << 1) | (1 << 2) : 1 << i;
+      unsigned * const lazyPatterns[3] = {&ctx->lazyClear.color, &ctx->lazyClear.depth,
+                                          &ctx->lazyClear.stencil
+                                         };
+      for (unsigned j = 0; j < 3; j++)
+         if (tagBits & (1 << j))
+            *lazyPatterns[j] = patterns[j];
+      const unsigned tilesX = (surface->width + (1 << GGL_CLEAR_TILE_SHIFT) - 1) >> GGL_CLEAR_TILE_SHIFT;
+      const unsigned tilesY = (surface->height + (1 << GGL_CLEAR_TILE_SHIFT) - 1) >> GGL_CLEAR_TILE_SHIFT;
+      for (unsigned y = 0; y < tilesY; y++)
+         for (unsigned x = 0; x < tilesX; x++) {
+            unsigned char & tag = ctx->lazyClear.tags[y * GGL_CLEAR_TILES_PER_ROW + x];
+            ctx->lazyClear.pendingTiles += !tag;
+            tag |= tagBits;
+         }
+#if USE_DUAL_THREAD
+      pthread_mutex_unlock(&ctx->lazyClear.lock);
+#endif
+   }
+}
+
+static void LazyClear(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   if (!enable)
+      ResolveLazyClear(ctx);
+   ctx->lazyClear.enable = enable;
+}
+
+static void ResolveMultisample(const GGLInterface * iface)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   const GGLSurface & surface = ctx->frameSurface, & samples = ctx->multisample.frameSurface;
+   if (!ctx->multisample.enable || !surface.data || !samples.data)
+      return;
+   const unsigned size = PixelFormatSize(surface.format);
+   if (4 == size) { // 8 bit channels are averaged in place of format
+      for (unsigned y = 0; y < surface.height; y++)
+         ResolveSamplesRGBA((unsigned *)surface.data + y * surface.width,
+                            (const unsigned *)samples.data + y * samples.width, surface.width);
+      return;
+   }
+   unsigned * row = (unsigned *)malloc(samples.width * sizeof(*row));
+   if (!row)
+      return gglError(GL_OUT_OF_MEMORY);
+   for (unsigned y = 0; y < surface.height; y++) {
+      ConvertPixels(row, GGL_PIXEL_FORMAT_RGBA_8888, (char *)samples.data + y * samples.width * size,
+                    samples.format, samples.width, false);
+      ResolveSamplesRGBA(row, row, surface.width);
+      ConvertPixels((char *)surface.data + y * surface.width * size, surface.format, row,
+                    GGL_PIXEL_FORMAT_RGBA_8888, surface.width, false);
+   }
+   free(row);
+}
+
+static void Finish(const GGLInterface * iface)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   ResolveLazyClear(ctx);
+   ResolveMultisample(iface);
+}
+
+static void FreeSampleSurfaces(GGLContext * ctx)
+{
+   if (ctx->multisample.stencilSurface.data != ctx->multisample.depthSurface.data)
+      free(ctx->multisample.stencilSurface.data);
+   free(ctx->multisample.depthSurface.data);
+   free(ctx->multisample.frameSurface.data);
+   memset(&ctx->multisample.frameSurface, 0, sizeof(ctx->multisample.frameSurface));
+   memset(&ctx->multisample.depthSurface, 0, sizeof(ctx->multisample.depthSurface));
+   memset(&ctx->multisample.stencilSurface, 0, sizeof(ctx->multisample.stencilSurface));
+}
+
+// 4 samples per pixel of surface
+static void AllocateSampleSurface(GGLSurface * samples, const GGLSurface * surface)
+{
+   *samples = *surface;
+   if (!surface->data)
+      return;
+   const unsigned size = PixelFormatSize(surface->format);
+   samples->width = surface->width * 4;
+   samples->stride = samples->width;
+   samples->data = malloc(samples->width * samples->height * size);
+   if (!samples->data) {
+      memset(samples, 0, sizeof(*samples));
+      return gglError(GL_OUT_OF_MEMORY);
+   }
+}
+
+// reallocates samples for surface, unless they have its dimensions and format
+static void ReallocateSampleSurface(GGLSurface * samples, const GGLSurface * surface)
+{
+   if (samples->data && surface->data && samples->format == surface->format &&
+         samples->width == surface->width * 4 && samples->height == surface->height)
+      return;
+   free(samples->data);
+   AllocateSampleSurface(samples, surface);
+}
+
+// initializes the samples of each pixel to the pixel
+static void ReplicateSamples(const GGLSurface * samples, const GGLSurface * surface)
+{
+   if (!samples->data)
+      return;
+   const unsigned size = PixelFormatSize(surface->format);
+   const char * src = (const char *)surface->data;
+   char * dst = (char *)samples->data;
+   for (unsigned i = 0; i < surface->width * surface->height; i++, src += size)
+      for (unsigned j = 0; j < 4; j++, dst += size)
+         memcpy(dst, src, size);
+}
+
+// allocates multisample buffers for the set surfaces
+static void AllocateSampleSurfaces(GGLContext * ctx)
+{
+   FreeSampleSurfaces(ctx);
+   // color samples start as the surface contents, depth and stencil are cleared before use
+   AllocateSampleSurface(&ctx->multisample.frameSurface, &ctx->frameSurface);
+   ReplicateSamples(&ctx->multisample.frameSurface, &ctx->frameSurface);
+   AllocateSampleSurface(&ctx->multisample.depthSurface, &ctx->depthSurface);
+   if (ctx->stencilSurface.data && ctx->stencilSurface.data == ctx->depthSurface.data)
+      ctx->multisample.stencilSurface = ctx->multisample.depthSurface; // SZ_24
+   else
+      AllocateSampleSurface(&ctx->multisample.stencilSurface, &ctx->stencilSurface);
+}
+
+// updates the multisample buffer of the surface of type SetBuffer replaced, keeping the others
+static void UpdateSampleSurfaces(GGLContext * ctx, const GLenum type)
+{
+   GGLSurface & depth = ctx->multisample.depthSurface, & stencil = ctx->multisample.stencilSurface;
+   if (GL_COLOR_BUFFER_BIT == type) {
+      // the old color samples were resolved, the new ones start as the surface contents
+      ReallocateSampleSurface(&ctx->multisample.frameSurface, &ctx->frameSurface);
+      ReplicateSamples(&ctx->multisample.frameSurface, &ctx->frameSurface);
+      return;
+   }
+   if (GL_DEPTH_BUFFER_BIT != type && GL_STENCIL_BUFFER_BIT != type)
+      return;
+   // SZ_24 stencil samples are the depth samples, so they are only rebound here
+   const bool sharedSamples = stencil.data && stencil.data == depth.data;
+   if (sharedSamples)
+      memset(&stencil, 0, sizeof(stencil));
+   if (GL_DEPTH_BUFFER_BIT == type)
+      ReallocateSampleSurface(&depth, &ctx->depthSurface);
+   if (ctx->stencilSurface.data && ctx->stencilSurface.data == ctx->depthSurface.data) {
+      free(stencil.data);
+      stencil = depth;
+   } else if (GL_STENCIL_BUFFER_BIT == type || sharedSamples)
+      ReallocateSampleSurface(&stencil, &ctx->stencilSurface);
+}
+
+static void SetMultisample(GGLInterface * iface, GLboolean enable)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   if (ctx->multisample.enable == (bool)enable)
+      return;
+   if (enable) {
+      ResolveLazyClear(ctx); // color samples are copied from the surface
+      AllocateSampleSurfaces(ctx);
+   } else
+      FreeSampleSurfaces(ctx); // samples not resolved by Finish or ResolveMultisample are lost
+   ctx->multisample.enable = enable;
+   ctx->state.bufferState.multisample = enable;
+   SetShaderVerifyFunctions(iface);
+}
+
+// copies width x height pixels between rows of stride pixels, converting format;
+// dst may overlap src if the formats are the same
+static void CopyRows(void * dst, const GGLPixelFormat dstFormat, const unsigned dstStride,
+                     const void * src, const GGLPixelFormat srcFormat, const unsigned srcStride,
+                     const unsigned width, const unsigned height)
+{
+   const unsigned dstSize = PixelFormatSize(dstFormat), srcSize = PixelFormatSize(srcFormat);
+   unsigned char * d = (unsigned char *)dst;
+   const unsigned char * s = (const unsigned char *)src;
+   if (dstFormat == srcFormat && dstStride == width && srcStride == width)
+      return (void)memmove(d, s, width * height * dstSize);
+   int dstStep = dstStride * dstSize, srcStep = srcStride * srcSize;
+   if (d > s && d < s + height * srcStep) { // overlapping rows below src, so copy bottom up
+      d += (height - 1) * dstStep;
+      s += (height - 1) * srcStep;
+      dstStep = -dstStep;
+      srcStep = -srcStep;
    }
+   for (unsigned i = 0; i < height; i++, d += dstStep, s += srcStep)
+      ConvertPixels(d, dstFormat, s, srcFormat, width, false);
+}
+
+static inline bool RectInSurface(const GGLSurface * surface, const GLint x, const GLint y,
+                                 const GLsizei width, const GLsizei height)
+{
+   return surface && surface->data && 0 <= x && 0 <= y && 0 <= width && 0 <= height &&
+          x + width <= (GLint)surface->width && y + height <= (GLint)surface->height;
+}
+
+static void ReadPixels(const GGLInterface * iface, GLint x, GLint y, GLsizei width,
+                       GLsizei height, GGLPixelFormat format, unsigned stride, void * pixels)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   const GGLSurface * src = &ctx->frameSurface;
+   if (!pixels || !RectInSurface(src, x, y, width, height))
+      return gglError(GL_INVALID_VALUE);
+   Finish(iface);
+   CopyRows(pixels, format, stride ? stride : width,
+            (char *)src->data + (y * src->width + x) * PixelFormatSize(src->format),
+            src->format, src->width, width, height);
+}
+
+static void CopySurface(const GGLInterface * iface, GGLSurface * dst, GLint dstX, GLint dstY,
+                        const GGLSurface * src, GLint srcX, GLint srcY, GLsizei width, GLsizei height)
+{
+   if (!RectInSurface(dst, dstX, dstY, width, height) ||
+         !RectInSurface(src, srcX, srcY, width, height))
+      return gglError(GL_INVALID_VALUE);
+   if (dst->data == src->data && dst->format != src->format)
+      return gglError(GL_INVALID_OPERATION);
+   Finish(iface); // either surface may be the target of a lazy clear or multisample resolve
+   CopyRows((char *)dst->data + (dstY * dst->width + dstX) * PixelFormatSize(dst->format),
+            dst->format, dst->width,
+            (char *)src->data + (srcY * src->width + srcX) * PixelFormatSize(src->format),
+            src->format, src->width, width, height);
+}
+
+static void BlitSurface(const GGLInterface * iface, GGLSurface * dst, GLint dstX, GLint dstY,
+                        GLsizei dstWidth, GLsizei dstHeight, const GGLSurface * src, GLint srcX,
+                        GLint srcY, GLsizei srcWidth, GLsizei srcHeight, GLenum filter)
+{
+   if (GL_NEAREST != filter && GL_LINEAR != filter)
+      return gglError(GL_INVALID_ENUM);
+   if (!RectInSurface(dst, dstX, dstY, dstWidth, dstHeight) ||
+         !RectInSurface(src, srcX, srcY, srcWidth, srcHeight))
+      return gglError(GL_INVALID_VALUE);
+   if (dstWidth == srcWidth && dstHeight == srcHeight)
+      return CopySurface(iface, dst, dstX, dstY, src, srcX, srcY, srcWidth, srcHeight);
+   if (!dstWidth || !dstHeight || !srcWidth || !srcHeight)
+      return;
+   Finish(iface);
+
+   // 1 source row converted to rgba_8888, 2 resampled rows and 1 destination row
+   unsigned * const rows = (unsigned *)malloc((srcWidth + 3 * dstWidth) * sizeof(*rows));
+   if (!rows)
+      return gglError(GL_OUT_OF_MEMORY);
+   unsigned * const srcRow = rows, * resampled[2] = {srcRow + srcWidth, srcRow + srcWidth + dstWidth};
+   unsigned * const dstRow = resampled[1] + dstWidth;
+   int resampledY[2] = {-1, -1}; // source row held by each resampled row
+
+   const bool linear = GL_LINEAR == filter;
+   const unsigned srcSize = PixelFormatSize(src->format), dstSize = PixelFormatSize(dst->format);
+   const unsigned step = (srcHeight << 16) / dstHeight; // 16.16 like ResampleRGBA
+   int position = linear ? (int)(step / 2) - 0x8000 : step / 2;
+   for (GLsizei y = 0; y < dstHeight; y++, position += step) {
+      const unsigned clamped = MAX2(position, 0);
+      const int y0 = MIN2(clamped >> 16, srcHeight - 1u);
+      const int sourceY[2] = {y0, MIN2(y0 + 1, srcHeight - 1)};
+      // interpolate only between 2 different rows with a non zero weight
+      const bool lerp = linear && (clamped & 0xff00) && sourceY[0] != sourceY[1];
+      for (unsigned i = 0; i < 1u + lerp; i++) {
+         if (resampledY[i] == sourceY[i])
+            continue;
+         if (resampledY[!i] == sourceY[i]) { // reuse the other row as rows advance
+            unsigned * const swap = resampled[i];
+            resampled[i] = resampled[!i];
+            resampled[!i] = swap;
+            resampledY[!i] = resampledY[i];
+            resampledY[i] = sourceY[i];
+            continue;
+         }
+         ConvertPixels(srcRow, GGL_PIXEL_FORMAT_RGBA_8888, (char *)src->data +
+                       ((srcY + sourceY[i]) * src->width + srcX) * srcSize, src->format, srcWidth, false);
+         ResampleRGBA(resampled[i], dstWidth, srcRow, srcWidth, linear);
+         resampledY[i] = sourceY[i];
+      }
+      const unsigned * row = resampled[0];
+      if (lerp) {
+         LerpRGBA(dstRow, resampled[0], resampled[1], (clamped >> 8) & 0xff, dstWidth);
+         row = dstRow;
+      }
+      ConvertPixels((char *)dst->data + ((dstY + y) * dst->width + dstX) * dstSize, dst->format,
+                    row, GGL_PIXEL_FORMAT_RGBA_8888, dstWidth, false);
+   }
+   free(rows);
 }
 
 static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surface)
 {
    GGL_GET_CONTEXT(ctx, iface);
    bool changed = false;
+   // tags and samples refer to the surfaces being replaced
+   ResolveLazyClear(ctx);
+   if (GL_COLOR_BUFFER_BIT == type)
+      ResolveMultisample(iface);
    if (GL_COLOR_BUFFER_BIT == type) {
       if (surface) {
-         ctx->frameSurface = *surface;
          changed |= ctx->frameSurface.format ^ surface->format;
+         ctx->frameSurface = *surface;
          switch (surface->format) {
          case GGL_PIXEL_FORMAT_RGBA_8888:
+         case GGL_PIXEL_FORMAT_BGRA_8888:
+         case GGL_PIXEL_FORMAT_RGBX_8888:
          case GGL_PIXEL_FORMAT_RGB_565:
             break;
-         case GGL_PIXEL_FORMAT_RGBX_8888:
          default:
             ALOGD("pf2: SetBuffer 0x%.04X format=0x%.02X \n", type, surface ? surface->format : 0);
             assert(0);
@@ -205,9 +690,11 @@ static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surf
       ctx->state.bufferState.colorFormat = ctx->frameSurface.format;
    } else if (GL_DEPTH_BUFFER_BIT == type) {
       if (surface) {
-         ctx->depthSurface = *surface;
          changed |= ctx->depthSurface.format ^ surface->format;
-         assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format);
+         ctx->depthSurface = *surface;
+         assert(GGL_PIXEL_FORMAT_Z_32 == ctx->depthSurface.format ||
+                GGL_PIXEL_FORMAT_Z_16 == ctx->depthSurface.format ||
+                GGL_PIXEL_FORMAT_SZ_24 == ctx->depthSurface.format);
       } else {
          memset(&ctx->depthSurface, 0, sizeof(ctx->depthSurface));
          changed = true;
@@ -215,9 +702,11 @@ static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surf
       ctx->state.bufferState.depthFormat = ctx->depthSurface.format;
    } else if (GL_STENCIL_BUFFER_BIT == type) {
       if (surface) {
-         ctx->stencilSurface = *surface;
          changed |= ctx->stencilSurface.format ^ surface->format;
-         assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format);
+         ctx->stencilSurface = *surface;
+         // SZ_24 stencil is the high 8 bits of the depth surface
+         assert(GGL_PIXEL_FORMAT_S_8 == ctx->stencilSurface.format ||
+                GGL_PIXEL_FORMAT_SZ_24 == ctx->stencilSurface.format);
       } else {
          memset(&ctx->stencilSurface, 0, sizeof(ctx->stencilSurface));
          changed = true;
@@ -225,6 +714,11 @@ static void SetBuffer(GGLInterface * iface, const GLenum type, GGLSurface * surf
       ctx->state.bufferState.stencilFormat = ctx->stencilSurface.format;
    } else
       gglError(GL_INVALID_ENUM);
+   const bool shared = ctx->stencilSurface.data && ctx->stencilSurface.data == ctx->depthSurface.data;
+   changed |= ctx->state.bufferState.sharedDepthStencil != shared;
+   ctx->state.bufferState.sharedDepthStencil = shared;
+   if (ctx->multisample.enable)
+      UpdateSampleSurfaces(ctx, type);
    if (changed) {
       SetShaderVerifyFunctions(iface);
    }
@@ -240,5 +734,12 @@ void InitializeBufferFunctions(GGLInterface * iface)
    iface->ClearColor = ClearColor;
    iface->ClearDepthf = ClearDepthf;
    iface->Clear = Clear;
+   iface->LazyClear = LazyClear;
+   iface->Finish = Finish;
+   iface->SetMultisample = SetMultisample;
+   iface->ResolveMultisample = ResolveMultisample;
+   iface->ReadPixels = ReadPixels;
+   iface->CopySurface = CopySurface;
+   iface->BlitSurface = BlitSurface;
    iface->SetBuffer = SetBuffer;
 }
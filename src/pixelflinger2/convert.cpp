@@ -0,0 +1,422 @@
+/**
+ **
+ ** Copyright 2010, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include <assert.h>
+#include <string.h>
+
+#include "src/pixelflinger2/pixelflinger2.h"
+
+// the kernels below use NEON whenever the compiler targets it (-mfpu=neon on armv7-a-neon),
+// independently of the USE_NEON opt in of the Vec4 paths, and SSE2 on x86
+#if defined(__ARM_NEON__)
+#define CONVERT_NEON 1
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define CONVERT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// pixels are converted through an intermediate rgba_8888 buffer of this many pixels
+#define CONVERT_CHUNK 64
+
+unsigned PixelFormatSize(const GGLPixelFormat format)
+{
+   size_t count = 0;
+   const GGLFormat * table = gglGetPixelFormatTable(&count);
+   assert(count > (size_t)format); // GGL_PIXEL_FORMAT_COUNT is past the end of the table
+   return table[format].size;
+}
+
+// r and b are swapped between rgba_8888 and bgra_8888, so the swizzle is its own inverse
+static void SwizzleRB(unsigned * dst, const unsigned * src, unsigned count)
+{
+#if CONVERT_NEON
+   for (; count >= 8; count -= 8, src += 8, dst += 8) {
+      uint8x8x4_t c = vld4_u8((const uint8_t *)src);
+      const uint8x8_t r = c.val[0];
+      c.val[0] = c.val[2];
+      c.val[2] = r;
+      vst4_u8((uint8_t *)dst, c);
+   }
+#elif CONVERT_SSE2
+   const __m128i ga = _mm_set1_epi32(0xff00ff00), low = _mm_set1_epi32(0xff);
+   for (; count >= 4; count -= 4, src += 4, dst += 4) {
+      const __m128i c = _mm_loadu_si128((const __m128i *)src);
+      __m128i d = _mm_or_si128(_mm_and_si128(c, ga), _mm_and_si128(_mm_srli_epi32(c, 16), low));
+      d = _mm_or_si128(d, _mm_slli_epi32(_mm_and_si128(c, low), 16));
+      _mm_storeu_si128((__m128i *)dst, d);
+   }
+#endif
+   for (; count; count--, src++, dst++) {
+      const unsigned c = *src;
+      *dst = (c & 0xff00ff00) | ((c >> 16) & 0xff) | ((c & 0xff) << 16);
+   }
+}
+
+static void SetAlpha(unsigned * dst, const unsigned * src, unsigned count)
+{
+#if CONVERT_NEON
+   const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+   for (; count >= 4; count -= 4, src += 4, dst += 4)
+      vst1q_u32(dst, vorrq_u32(vld1q_u32(src), alpha));
+#elif CONVERT_SSE2
+   const __m128i alpha = _mm_set1_epi32(0xff000000);
+   for (; count >= 4; count -= 4, src += 4, dst += 4)
+      _mm_storeu_si128((__m128i *)dst, _mm_or_si128(_mm_loadu_si128((const __m128i *)src), alpha));
+#endif
+   for (; count; count--, src++, dst++)
+      *dst = *src | 0xff000000;
+}
+
+// c * a / 255 for r, g and b, rounded; alpha is kept
+static void Premultiply(unsigned * dst, const unsigned * src, unsigned count)
+{
+#if CONVERT_NEON
+   for (; count >= 8; count -= 8, src += 8, dst += 8) {
+      uint8x8x4_t c = vld4_u8((const uint8_t *)src);
+      for (unsigned i = 0; i < 3; i++) {
+         const uint16x8_t t = vmull_u8(c.val[i], c.val[3]);
+         // (t + 128 + ((t + 128) >> 8)) >> 8
+         c.val[i] = vraddhn_u16(t, vrshrq_n_u16(t, 8));
+      }
+      vst4_u8((uint8_t *)dst, c);
+   }
+#elif CONVERT_SSE2
+   // channels are widened to 16 bit lanes and multiplied by the alpha of their pixel
+   const __m128i zero = _mm_setzero_si128(), round = _mm_set1_epi16(0x80);
+   const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+   for (; count >= 4; count -= 4, src += 4, dst += 4) {
+      const __m128i c = _mm_loadu_si128((const __m128i *)src);
+      __m128i p[2] = {_mm_unpacklo_epi8(c, zero), _mm_unpackhi_epi8(c, zero)};
+      for (unsigned i = 0; i < 2; i++) {
+         __m128i a = _mm_shufflelo_epi16(p[i], _MM_SHUFFLE(3, 3, 3, 3));
+         a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+         const __m128i t = _mm_add_epi16(_mm_mullo_epi16(p[i], a), round);
+         p[i] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+      }
+      const __m128i rgb = _mm_andnot_si128(alphaMask, _mm_packus_epi16(p[0], p[1]));
+      _mm_storeu_si128((__m128i *)dst, _mm_or_si128(rgb, _mm_and_si128(c, alphaMask)));
+   }
+#endif
+   for (; count; count--, src++, dst++) {
+      const unsigned c = *src, a = c >> 24;
+      unsigned rb = (c & 0x00ff00ff) * a + 0x00800080;
+      rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+      unsigned g = ((c >> 8) & 0xff) * a + 0x80;
+      g = ((g + (g >> 8)) >> 8) & 0xff;
+      *dst = (c & 0xff000000) | (g << 8) | rb;
+   }
+}
+
+static void UnpackRGB565(unsigned * dst, const unsigned short * src, unsigned count)
+{
+   for (; count; count--, src++, dst++) {
+      const unsigned c = *src;
+      unsigned r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+      r = (r << 3) | (r >> 2);
+      g = (g << 2) | (g >> 4);
+      b = (b << 3) | (b >> 2);
+      *dst = 0xff000000 | (b << 16) | (g << 8) | r;
+   }
+}
+
+static void PackRGB565(unsigned short * dst, const unsigned * src, unsigned count)
+{
+#if CONVERT_NEON
+   for (; count >= 8; count -= 8, src += 8, dst += 8) {
+      const uint8x8x4_t c = vld4_u8((const uint8_t *)src);
+      uint16x8_t p = vshlq_n_u16(vmovl_u8(vshr_n_u8(c.val[0], 3)), 11);
+      p = vorrq_u16(p, vshlq_n_u16(vmovl_u8(vshr_n_u8(c.val[1], 2)), 5));
+      p = vorrq_u16(p, vmovl_u8(vshr_n_u8(c.val[2], 3)));
+      vst1q_u16(dst, p);
+   }
+#elif CONVERT_SSE2
+   const __m128i r = _mm_set1_epi32(0xf8), g = _mm_set1_epi32(0xfc00), b = _mm_set1_epi32(0xf80000);
+   for (; count >= 8; count -= 8, src += 8, dst += 8) {
+      __m128i p[2];
+      for (unsigned i = 0; i < 2; i++) {
+         const __m128i c = _mm_loadu_si128((const __m128i *)src + i);
+         p[i] = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(c, r), 8),
+                             _mm_srli_epi32(_mm_and_si128(c, g), 5));
+         p[i] = _mm_or_si128(p[i], _mm_srli_epi32(_mm_and_si128(c, b), 19));
+         // sign extended, so the signed saturating pack keeps the 16 bits
+         p[i] = _mm_srai_epi32(_mm_slli_epi32(p[i], 16), 16);
+      }
+      _mm_storeu_si128((__m128i *)dst, _mm_packs_epi32(p[0], p[1]));
+   }
+#endif
+   for (; count; count--, src++, dst++) {
+      const unsigned c = *src;
+      *dst = ((c & 0xf8) << 8) | ((c & 0xfc00) >> 5) | ((c & 0xf80000) >> 19);
+   }
+}
+
+// expands a channel of bits width to 8 bits by replicating the high bits
+static inline unsigned ExpandChannel(unsigned value, const unsigned bits)
+{
+   if (bits >= 8)
+      return value >> (bits - 8);
+   unsigned result = 0;
+   for (int shift = 8 - bits; shift > -(int)bits; shift -= bits)
+      result |= shift >= 0 ? value << shift : value >> -shift;
+   return result & 0xff;
+}
+
+// generic unpack using gglGetPixelFormatTable, for formats without a fast path
+static void UnpackGeneric(unsigned * dst, const unsigned char * src,
+                          const GGLPixelFormat format, unsigned count)
+{
+   const GGLFormat & info = gglGetPixelFormatTable()[format];
+   assert(info.size > 0 && info.size <= 4);
+   assert(GGL_STENCIL_INDEX != info.components && GGL_DEPTH_COMPONENT != info.components);
+   // ALPHA, RED, GREEN, BLUE index order of GGLFormat::c to byte position in rgba_8888
+   static const unsigned channelShift[4] = {24, 0, 8, 16};
+   for (; count; count--, src += info.size, dst++) {
+      unsigned c = 0;
+      for (unsigned i = 0; i < info.size; i++)
+         c |= src[i] << (i * 8);
+      unsigned rgba = 0;
+      for (unsigned i = 0; i < 4; i++) {
+         const unsigned bits = info.bits(i);
+         if (bits)
+            rgba |= ExpandChannel((c >> info.c[i].l) & ((1 << bits) - 1), bits) << channelShift[i];
+         else if (GGLFormat::ALPHA == i)
+            rgba |= 0xff000000;
+      }
+      *dst = rgba;
+   }
+}
+
+static void PackGeneric(unsigned char * dst, const GGLPixelFormat format,
+                        const unsigned * src, unsigned count)
+{
+   const GGLFormat & info = gglGetPixelFormatTable()[format];
+   assert(info.size > 0 && info.size <= 4);
+   assert(GGL_STENCIL_INDEX != info.components && GGL_DEPTH_COMPONENT != info.components);
+   static const unsigned channelShift[4] = {24, 0, 8, 16};
+   // luminance uses the same bits for red, green and blue; take red as GL does
+   const unsigned channels = GGL_LUMINANCE == info.components ||
+                             GGL_LUMINANCE_ALPHA == info.components ? 2 : 4;
+   for (; count; count--, dst += info.size, src++) {
+      unsigned c = 0;
+      for (unsigned i = 0; i < channels; i++) {
+         const unsigned bits = info.bits(i);
+         if (!bits)
+            continue;
+         const unsigned value = (*src >> channelShift[i]) & 0xff;
+         c |= (bits >= 8 ? value << (bits - 8) : value >> (8 - bits)) << info.c[i].l;
+      }
+      for (unsigned i = 0; i < info.size; i++)
+         dst[i] = c >> (i * 8);
+   }
+}
+
+// returns pointer to rgba_8888 pixels, which may be src itself
+static const unsigned * Unpack(unsigned * rgba, const void * src,
+                               const GGLPixelFormat format, const unsigned count)
+{
+   switch (format) {
+   case GGL_PIXEL_FORMAT_RGBA_8888:
+      return (const unsigned *)src;
+   case GGL_PIXEL_FORMAT_RGBX_8888:
+      SetAlpha(rgba, (const unsigned *)src, count);
+      break;
+   case GGL_PIXEL_FORMAT_BGRA_8888:
+      SwizzleRB(rgba, (const unsigned *)src, count);
+      break;
+   case GGL_PIXEL_FORMAT_RGB_565:
+      UnpackRGB565(rgba, (const unsigned short *)src, count);
+      break;
+   default:
+      UnpackGeneric(rgba, (const unsigned char *)src, format, count);
+      break;
+   }
+   return rgba;
+}
+
+static void Pack(void * dst, const GGLPixelFormat format,
+                 const unsigned * rgba, const unsigned count)
+{
+   switch (format) {
+   case GGL_PIXEL_FORMAT_RGBA_8888:
+      if (dst != rgba)
+         memcpy(dst, rgba, count * 4);
+      break;
+   case GGL_PIXEL_FORMAT_RGBX_8888:
+      SetAlpha((unsigned *)dst, rgba, count);
+      break;
+   case GGL_PIXEL_FORMAT_BGRA_8888:
+      SwizzleRB((unsigned *)dst, rgba, count);
+      break;
+   case GGL_PIXEL_FORMAT_RGB_565:
+      PackRGB565((unsigned short *)dst, rgba, count);
+      break;
+   default:
+      PackGeneric((unsigned char *)dst, format, rgba, count);
+      break;
+   }
+}
+
+void ConvertPixels(void * dst, const GGLPixelFormat dstFormat, const void * src,
+                   const GGLPixelFormat srcFormat, const unsigned count, const bool premultiply)
+{
+   const unsigned srcSize = PixelFormatSize(srcFormat), dstSize = PixelFormatSize(dstFormat);
+   if (srcFormat == dstFormat && !premultiply) {
+      if (dst != src)
+         memmove(dst, src, count * srcSize);
+      return;
+   }
+   // rgba_8888 source is packed directly without going through the intermediate buffer
+   if (!premultiply && GGL_PIXEL_FORMAT_RGBA_8888 == srcFormat)
+      return Pack(dst, dstFormat, (const unsigned *)src, count);
+
+   unsigned rgba[CONVERT_CHUNK];
+   for (unsigned i = 0; i < count; i += CONVERT_CHUNK) {
+      const unsigned n = MIN2(CONVERT_CHUNK, count - i);
+      const unsigned * pixels = Unpack(rgba, (const unsigned char *)src + i * srcSize, srcFormat, n);
+      if (premultiply) {
+         Premultiply(rgba, pixels, n);
+         pixels = rgba;
+      }
+      Pack((unsigned char *)dst + i * dstSize, dstFormat, pixels, n);
+   }
+}
+
+// averages 2x2 blocks of rgba_8888 rows a and b into count pixels of dst;
+// rows hold 2 * count pixels, last odd column should be replicated by caller
+void BoxFilterRGBA(unsigned * dst, const unsigned * a, const unsigned * b, unsigned count)
+{
+#if CONVERT_NEON
+   for (; count >= 4; count -= 4, a += 8, b += 8, dst += 4) {
+      const uint32x4x2_t ra = vld2q_u32(a), rb = vld2q_u32(b);
+      const uint8x16_t top = vrhaddq_u8(vreinterpretq_u8_u32(ra.val[0]), vreinterpretq_u8_u32(ra.val[1]));
+      const uint8x16_t bottom = vrhaddq_u8(vreinterpretq_u8_u32(rb.val[0]), vreinterpretq_u8_u32(rb.val[1]));
+      vst1q_u32(dst, vreinterpretq_u32_u8(vrhaddq_u8(top, bottom)));
+   }
+#elif CONVERT_SSE2
+   for (; count >= 4; count -= 4, a += 8, b += 8, dst += 4) {
+      // even and odd pixels of each row, like vld2
+      const __m128 a0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)a));
+      const __m128 a1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)a + 1));
+      const __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)b));
+      const __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)b + 1));
+      const __m128i top = _mm_avg_epu8(_mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2, 0, 2, 0))),
+                                       _mm_castps_si128(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3, 1, 3, 1))));
+      const __m128i bottom = _mm_avg_epu8(_mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0))),
+                                          _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1))));
+      _mm_storeu_si128((__m128i *)dst, _mm_avg_epu8(top, bottom));
+   }
+#endif
+   // channels are spread into 16 bit lanes so that 4 samples can be summed without overflow
+   for (; count; count--, a += 2, b += 2, dst++) {
+      const unsigned rb = ((a[0] & 0x00ff00ff) + (a[1] & 0x00ff00ff) +
+                           (b[0] & 0x00ff00ff) + (b[1] & 0x00ff00ff) + 0x00020002) >> 2;
+      const unsigned ag = (((a[0] >> 8) & 0x00ff00ff) + ((a[1] >> 8) & 0x00ff00ff) +
+                           ((b[0] >> 8) & 0x00ff00ff) + ((b[1] >> 8) & 0x00ff00ff) + 0x00020002) >> 2;
+      *dst = (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+   }
+}
+
+void ResolveSamplesRGBA(unsigned * dst, const unsigned * samples, unsigned count)
+{
+#if CONVERT_NEON
+   // vld4 deinterleaves, so lane i of val[j] is sample j of pixel i
+   for (; count >= 4; count -= 4, samples += 16, dst += 4) {
+      const uint32x4x4_t s = vld4q_u32(samples);
+      const uint8x16_t top = vrhaddq_u8(vreinterpretq_u8_u32(s.val[0]), vreinterpretq_u8_u32(s.val[1]));
+      const uint8x16_t bottom = vrhaddq_u8(vreinterpretq_u8_u32(s.val[2]), vreinterpretq_u8_u32(s.val[3]));
+      vst1q_u32(dst, vreinterpretq_u32_u8(vrhaddq_u8(top, bottom)));
+   }
+#elif CONVERT_SSE2
+   // transposed so that register j holds sample j of 4 pixels, like vld4
+   for (; count >= 4; count -= 4, samples += 16, dst += 4) {
+      __m128 s0 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)samples));
+      __m128 s1 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)samples + 1));
+      __m128 s2 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)samples + 2));
+      __m128 s3 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)samples + 3));
+      _MM_TRANSPOSE4_PS(s0, s1, s2, s3);
+      const __m128i top = _mm_avg_epu8(_mm_castps_si128(s0), _mm_castps_si128(s1));
+      const __m128i bottom = _mm_avg_epu8(_mm_castps_si128(s2), _mm_castps_si128(s3));
+      _mm_storeu_si128((__m128i *)dst, _mm_avg_epu8(top, bottom));
+   }
+#endif
+   // samples are the 2x2 block of the pixel, so this is BoxFilterRGBA with both rows in place
+   for (; count; count--, samples += 4, dst++)
+      BoxFilterRGBA(dst, samples, samples + 2, 1);
+}
+
+// a * (256 - weight) + b * weight with channels spread into 16 bit lanes, weight is [0,256]
+static inline unsigned LerpPixel(const unsigned a, const unsigned b, const unsigned weight)
+{
+   const unsigned rb = ((a & 0x00ff00ff) * (256 - weight) + (b & 0x00ff00ff) * weight) >> 8;
+   const unsigned ag = ((a >> 8) & 0x00ff00ff) * (256 - weight) + ((b >> 8) & 0x00ff00ff) * weight;
+   return (rb & 0x00ff00ff) | (ag & 0xff00ff00);
+}
+
+// interpolates count pixels of rgba_8888 rows a and b by weight / 256 of b, weight is [0,255]
+void LerpRGBA(unsigned * dst, const unsigned * a, const unsigned * b, const unsigned weight,
+              unsigned count)
+{
+#if CONVERT_NEON
+   // a * (256 - weight) is computed as (a << 8) - a * weight to keep weight in 8 bits
+   const uint8x8_t w = vdup_n_u8(weight);
+   for (; count >= 4; count -= 4, a += 4, b += 4, dst += 4) {
+      const uint8x16_t va = vreinterpretq_u8_u32(vld1q_u32(a));
+      const uint8x16_t vb = vreinterpretq_u8_u32(vld1q_u32(b));
+      uint16x8_t low = vshll_n_u8(vget_low_u8(va), 8), high = vshll_n_u8(vget_high_u8(va), 8);
+      low = vmlal_u8(vmlsl_u8(low, vget_low_u8(va), w), vget_low_u8(vb), w);
+      high = vmlal_u8(vmlsl_u8(high, vget_high_u8(va), w), vget_high_u8(vb), w);
+      vst1q_u32(dst, vreinterpretq_u32_u8(vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8))));
+   }
+#elif CONVERT_SSE2
+   // a * (256 - weight) + b * weight is at most 255 * 256, so 16 bit lanes do not overflow
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i wa = _mm_set1_epi16(256 - weight), wb = _mm_set1_epi16(weight);
+   for (; count >= 4; count -= 4, a += 4, b += 4, dst += 4) {
+      const __m128i va = _mm_loadu_si128((const __m128i *)a), vb = _mm_loadu_si128((const __m128i *)b);
+      __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                                  _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+      __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                                   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+      low = _mm_srli_epi16(low, 8);
+      high = _mm_srli_epi16(high, 8);
+      _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(low, high));
+   }
+#endif
+   for (; count; count--)
+      *dst++ = LerpPixel(*a++, *b++, weight);
+}
+
+// resamples srcWidth rgba_8888 pixels to dstWidth pixels with pixel centers aligned;
+// linear interpolates between the 2 nearest pixels, otherwise picks the nearest
+void ResampleRGBA(unsigned * dst, const unsigned dstWidth, const unsigned * src,
+                  const unsigned srcWidth, const bool linear)
+{
+   // 16.16 fixed point source position of the center of each destination pixel
+   const unsigned step = (srcWidth << 16) / dstWidth;
+   if (!linear) {
+      for (unsigned x = 0, position = step / 2; x < dstWidth; x++, position += step)
+         dst[x] = src[MIN2(position >> 16, srcWidth - 1)];
+      return;
+   }
+   int position = (int)(step / 2) - 0x8000; // center of the 2 source pixels that are interpolated
+   for (unsigned x = 0; x < dstWidth; x++, position += step) {
+      const unsigned clamped = MAX2(position, 0);
+      const unsigned x0 = MIN2(clamped >> 16, srcWidth - 1), x1 = MIN2(x0 + 1, srcWidth - 1);
+      dst[x] = LerpPixel(src[x0], src[x1], (clamped >> 8) & 0xff);
+   }
+}
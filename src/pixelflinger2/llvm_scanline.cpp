@@ -18,8 +18,10 @@
 #include "src/pixelflinger2/pixelflinger2.h"
 #include "src/pixelflinger2/llvm_helper.h"
 #include "src/mesa/main/mtypes.h"
+#include "src/glsl/ast.h"
 
 #include <llvm/Module.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 
 //#undef ALOGD
 //#define ALOGD(...)
@@ -122,6 +124,19 @@ static void StencilFunc(IRBuilder<> & builder, const unsigned char func,
    }
 }
 
+// stores 24 bit unorm z and 8 bit s into packed SZ_24 ptr; NULL keeps that part of word
+static void StoreDepthStencil(IRBuilder<> & builder, Value * ptr, Value * word,
+                              Value * z, Value * s)
+{
+   if (!z)
+      z = builder.CreateAnd(word, builder.getInt32(0x00ffffff));
+   if (s)
+      s = builder.CreateShl(builder.CreateZExt(s, builder.getInt32Ty()), 24);
+   else
+      s = builder.CreateAnd(word, builder.getInt32(0xff000000));
+   builder.CreateStore(builder.CreateOr(z, s), ptr);
+}
+
 static Value * BlendFactor(const unsigned mode, Value * src, Value * dst,
                            Value * constant, Value * one, Value * zero,
                            Value * srcA, Value * dstA, Value * constantA,
@@ -208,12 +223,19 @@ static Value * Saturate(IRBuilder<> & builder, Value * intVector)
 // RGB_565 channel order is weird
 static Value * IntVectorToScreenColor(IRBuilder<> & builder, const GGLPixelFormat format, Value * src)
 {
-   if (GGL_PIXEL_FORMAT_RGBA_8888 == format) {
-      src = builder.CreateShl(src, constIntVec(builder, 0, 8, 16, 24));
+   if (GGL_PIXEL_FORMAT_RGBA_8888 == format || GGL_PIXEL_FORMAT_BGRA_8888 == format ||
+         GGL_PIXEL_FORMAT_RGBX_8888 == format) {
+      if (GGL_PIXEL_FORMAT_BGRA_8888 == format)
+         src = builder.CreateShl(src, constIntVec(builder, 16, 8, 0, 24));
+      else
+         src = builder.CreateShl(src, constIntVec(builder, 0, 8, 16, 24));
       std::vector<Value *> comps = extractVector(builder, src);
       comps[0] = builder.CreateOr(comps[0], comps[1]);
       comps[0] = builder.CreateOr(comps[0], comps[2]);
-      comps[0] = builder.CreateOr(comps[0], comps[3]);
+      if (GGL_PIXEL_FORMAT_RGBX_8888 == format) // x is written as opaque alpha
+         comps[0] = builder.CreateOr(comps[0], builder.getInt32(0xff000000));
+      else
+         comps[0] = builder.CreateOr(comps[0], comps[3]);
       return comps[0];
    } else if (GGL_PIXEL_FORMAT_RGB_565 == format) {
       src = builder.CreateAnd(src, constIntVec(builder, 0xf8, 0xfc, 0xf8, 0));
@@ -244,6 +266,13 @@ static Value * ScreenColorToIntVector(IRBuilder<> & builder, const GGLPixelForma
    if (GGL_PIXEL_FORMAT_RGBA_8888 == format) {
       dst = builder.CreateLShr(dst, constIntVec(builder, 0, 8, 16, 24));
       dst = builder.CreateAnd(dst, constIntVec(builder, 0xff, 0xff, 0xff, 0xff));
+   } else if (GGL_PIXEL_FORMAT_BGRA_8888 == format) {
+      dst = builder.CreateLShr(dst, constIntVec(builder, 16, 8, 0, 24));
+      dst = builder.CreateAnd(dst, constIntVec(builder, 0xff, 0xff, 0xff, 0xff));
+   } else if (GGL_PIXEL_FORMAT_RGBX_8888 == format) { // x is read as opaque alpha
+      dst = builder.CreateLShr(dst, constIntVec(builder, 0, 8, 16, 24));
+      dst = builder.CreateAnd(dst, constIntVec(builder, 0xff, 0xff, 0xff, 0));
+      dst = builder.CreateOr(dst, constIntVec(builder, 0, 0, 0, 0xff));
    } else if (GGL_PIXEL_FORMAT_RGB_565 == format) {
       // channel order is weird
       dst = builder.CreateAnd(dst, constIntVec(builder, 0xf800, 0x7e0, 0x1f, 0));
@@ -257,12 +286,121 @@ static Value * ScreenColorToIntVector(IRBuilder<> & builder, const GGLPixelForma
    return dst;
 }
 
+// 4x4 bayer matrix thresholds [0,15], 4 bits each, row y in bits [y * 16, y * 16 + 16)
+static const uint64_t ditherMatrix = 0x5d7f91b36e4ca280ull;
+
+// src is int32x4 [0,255] rgba before saturation; threshold is i32 [0,15] from ditherMatrix,
+// scaled to below one step of the 5 and 6 bit RGB_565 channels that truncation drops
+static Value * Dither565(IRBuilder<> & builder, Value * src, Value * threshold)
+{
+   Value * offset = intVec(builder, threshold, threshold, threshold, threshold);
+   offset = builder.CreateLShr(offset, constIntVec(builder, 1, 2, 1, 0));
+   offset = builder.CreateAnd(offset, constIntVec(builder, 0xff, 0xff, 0xff, 0));
+   return builder.CreateAdd(src, offset);
+}
+
+static VectorType * shortVecType(IRBuilder<> & builder)
+{
+   return VectorType::get(builder.getInt16Ty(), 4);
+}
+
+static Value * constShortVec(IRBuilder<> & builder, const short v)
+{
+   return builder.CreateTrunc(constIntVec(builder, v, v, v, v), shortVecType(builder));
+}
+
+// src is <4 x float> approx [0,1]; return is <4 x i16> [0,255], rounded
+// lowp only has 8 bits of precision, so this loses nothing for lowp color math
+static Value * FloatColorToShortVector(IRBuilder<> & builder, Value * src)
+{
+   src = builder.CreateFMul(src, constFloatVec(builder, 255, 255, 255, 255));
+   src = builder.CreateFAdd(src, constFloatVec(builder, 0.5f, 0.5f, 0.5f, 0.5f));
+   // clamped as float, so the narrow conversion can't overflow; NaN becomes 0
+   Value * bound = Constant::getNullValue(floatVecType(builder));
+   src = builder.CreateSelect(builder.CreateFCmpOGT(src, bound), src, bound);
+   bound = constFloatVec(builder, 255, 255, 255, 255);
+   src = builder.CreateSelect(builder.CreateFCmpOLT(src, bound), src, bound);
+   return builder.CreateFPToUI(src, shortVecType(builder));
+}
+
+// src is <4 x i16> [0,255] rgba; 8888 formats are packed by narrowing to bytes, others
+// go through IntVectorToScreenColor
+static Value * ShortVectorToScreenColor(IRBuilder<> & builder, const GGLPixelFormat format,
+                                        Value * src, Value * dither)
+{
+   if (GGL_PIXEL_FORMAT_RGBA_8888 == format || GGL_PIXEL_FORMAT_BGRA_8888 == format ||
+         GGL_PIXEL_FORMAT_RGBX_8888 == format) {
+      if (GGL_PIXEL_FORMAT_BGRA_8888 == format) {
+         Constant * swizzle[4] = {builder.getInt32(2), builder.getInt32(1), builder.getInt32(0),
+                                  builder.getInt32(3)
+                                 };
+         src = builder.CreateShuffleVector(src, UndefValue::get(src->getType()),
+                                           ConstantVector::get(ArrayRef<Constant *>(swizzle)));
+      }
+      src = builder.CreateTrunc(src, VectorType::get(builder.getInt8Ty(), 4));
+      src = builder.CreateBitCast(src, builder.getInt32Ty());
+      if (GGL_PIXEL_FORMAT_RGBX_8888 == format) // x is written as opaque alpha
+         src = builder.CreateOr(src, builder.getInt32(0xff000000));
+      return src;
+   }
+   src = builder.CreateZExt(src, intVecType(builder));
+   if (dither)
+      src = Saturate(builder, Dither565(builder, src, dither));
+   return IntVectorToScreenColor(builder, format, src);
+}
+
+// lowp blending in 16 bit lanes; each product is shifted before the add or subtract
+// to fit, which may be 1 below the 32 bit result
+static Value * BlendShortVector(const GGLState * gglCtx, IRBuilder<> & builder,
+                                Value * src, Value * dst, Value * sf, Value * df)
+{
+   src = builder.CreateMul(src, builder.CreateTrunc(sf, shortVecType(builder)));
+   dst = builder.CreateMul(builder.CreateTrunc(dst, shortVecType(builder)),
+                           builder.CreateTrunc(df, shortVecType(builder)));
+   // products are at most 255 * 256, so the shift is unsigned
+   src = builder.CreateLShr(src, constShortVec(builder, 8));
+   dst = builder.CreateLShr(dst, constShortVec(builder, 8));
+
+   const unsigned equations[2] = {gglCtx->blendState.ce, gglCtx->blendState.ae};
+   Value * res[2] = {NULL, NULL};
+   for (unsigned i = 0; i < 2; i++)
+      switch (equations[i] + GL_FUNC_ADD) {
+      case GL_FUNC_ADD:
+         res[i] = builder.CreateAdd(src, dst);
+         break;
+      case GL_FUNC_SUBTRACT:
+         res[i] = builder.CreateSub(src, dst);
+         break;
+      case GL_FUNC_REVERSE_SUBTRACT:
+         res[i] = builder.CreateSub(dst, src);
+         break;
+      default:
+         assert(0);
+         break;
+      }
+   if (equations[0] != equations[1])
+      res[0] = builder.CreateInsertElement(res[0], builder.CreateExtractElement(res[1],
+                                           builder.getInt32(3)), builder.getInt32(3),
+                                           name("resAStore"));
+
+   Value * bound = Constant::getNullValue(shortVecType(builder));
+   res[0] = builder.CreateSelect(builder.CreateICmpSGT(res[0], bound), res[0], bound);
+   bound = constShortVec(builder, 255);
+   return builder.CreateSelect(builder.CreateICmpSLT(res[0], bound), res[0], bound);
+}
+
 // src is <4 x float> approx [0,1]; dst is <4 x i32> [0,255] from frame buffer; return is i32
+// dither is i32 [0,15] ordered dither threshold, or NULL
+// lowp is set for lowp fragment shaders, which pack and blend color in 16 bit lanes
 Value * GenerateFSBlend(const GGLState * gglCtx, const GGLPixelFormat format, /*const RegDesc * regDesc,*/
-                        IRBuilder<> & builder, Value * src, Value * dst)
+                        IRBuilder<> & builder, Value * src, Value * dst, Value * dither,
+                        const bool lowp)
 {
    Type * const intType = builder.getInt32Ty();
 
+   if (lowp && !gglCtx->blendState.enable)
+      return ShortVectorToScreenColor(builder, format, FloatColorToShortVector(builder, src), dither);
+
    // TODO cast the outputs pointer type to int for writing to minimize bandwidth
    if (!gglCtx->blendState.enable) {
 //        if (regDesc->IsInt32Color())
@@ -275,6 +413,8 @@ Value * GenerateFSBlend(const GGLState * gglCtx, const GGLPixelFormat format, /*
 //        {
       src = builder.CreateFMul(src, constFloatVec(builder,255,255,255,255));
       src = builder.CreateFPToSI(src, intVecType(builder));
+      if (dither)
+         src = Dither565(builder, src, dither);
       src = Saturate(builder, src);
       src = IntVectorToScreenColor(builder, format, src);
 //        }
@@ -320,8 +460,14 @@ Value * GenerateFSBlend(const GGLState * gglCtx, const GGLPixelFormat format, /*
 //    }
 //    else if (regDesc->IsVectorType(Float))
 //    {
-   src = builder.CreateFMul(src, constFloatVec(builder,255,255,255,255));
-   src = builder.CreateFPToSI(src, intVecType(builder));
+   Value * srcShort = NULL;
+   if (lowp) {
+      srcShort = FloatColorToShortVector(builder, src);
+      src = builder.CreateZExt(srcShort, intVecType(builder));
+   } else {
+      src = builder.CreateFMul(src, constFloatVec(builder,255,255,255,255));
+      src = builder.CreateFPToSI(src, intVecType(builder));
+   }
 //    }
 //    else
 //        assert(0);
@@ -371,6 +517,11 @@ Value * GenerateFSBlend(const GGLState * gglCtx, const GGLPixelFormat format, /*
    sf = builder.CreateAdd(sf, builder.CreateLShr(sf, constIntVec(builder,7,7,7,7)));
    df = builder.CreateAdd(df, builder.CreateLShr(df, constIntVec(builder,7,7,7,7)));
 
+   if (lowp)
+      return ShortVectorToScreenColor(builder, format,
+                                      BlendShortVector(gglCtx, builder, srcShort, dst, sf, df),
+                                      dither);
+
    src = builder.CreateMul(src, sf);
    dst = builder.CreateMul(dst, df);
 
@@ -412,6 +563,8 @@ Value * GenerateFSBlend(const GGLState * gglCtx, const GGLPixelFormat format, /*
    }
 
    res = builder.CreateAShr(res, constIntVec(builder,8,8,8,8));
+   if (dither)
+      res = Dither565(builder, res, dither);
    res = Saturate(builder, res);
    res = IntVectorToScreenColor(builder, format, res);
    return res;
@@ -434,6 +587,7 @@ static FunctionType * ScanLineFunctionType(IRBuilder<> & builder)
    funcArgs.push_back(bytePointerType); // stencil
    funcArgs.push_back(bytePointerType); // stencil state
    funcArgs.push_back(intType); // count
+   funcArgs.push_back(bytePointerType); // coverage
 
    FunctionType *functionType = FunctionType::get(/*Result=*/builder.getVoidTy(),
                                                   llvm::ArrayRef<Type*>(funcArgs),
@@ -442,9 +596,216 @@ static FunctionType * ScanLineFunctionType(IRBuilder<> & builder)
    return functionType;
 }
 
+// alloca in entry block, so it is not repeated for each fragment and can be promoted
+static Value * EntryAlloca(IRBuilder<> & builder, Type * type, const char * name)
+{
+   BasicBlock & entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+   IRBuilder<> entryBuilder(&entry, entry.begin());
+   return entryBuilder.CreateAlloca(type, NULL, name);
+}
+
+// values of the scanline shared by the depth stencil test of each sample
+struct DepthStencilValues {
+   bool depthPacked, stencilPacked, depth16;
+   bool sharedWord; // packed depth and stencil are in the same SZ_24 word
+   Value * sFace, * sRef, * sMask;
+   Value * z; // incoming z in depth buffer format
+};
+
+// incoming z of fragment at start converted to the depth buffer format
+static Value * GenerateFragmentZ(IRBuilder<> & builder, Value * start,
+                                 const DepthStencilValues & values)
+{
+   Type * intType = builder.getInt32Ty();
+   Type * floatType = builder.getFloatTy();
+   Value * z = NULL;
+   if (values.depthPacked || values.depth16) {
+      // quantize incoming z to 24 or 16 bit unorm the same way as ClearDepthf
+      z = builder.CreateBitCast(start, PointerType::get(floatType, 0));
+      z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
+                                             GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
+      z = builder.CreateLoad(z, "zf");
+      Value * const zero = ConstantFP::get(floatType, 0.0);
+      Value * const one = ConstantFP::get(floatType, 1.0);
+      z = builder.CreateSelect(builder.CreateFCmpOLT(z, zero), zero, z);
+      z = builder.CreateSelect(builder.CreateFCmpOGT(z, one), one, z);
+      z = builder.CreateFMul(z, ConstantFP::get(floatType, values.depth16 ? 65535.0 : 16777215.0));
+      return builder.CreateFPToUI(z, values.depth16 ? builder.getInt16Ty() : intType, "z");
+   }
+   z = builder.CreateBitCast(start, PointerType::get(intType, 0));
+   z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
+                                          GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
+   z = builder.CreateLoad(z, "zBits");
+   // if (0x80000000 & z) z ^= 0x7fffffff since smaller -ve float means bigger -ve int
+   Value * zNegative = builder.CreateICmpSLT(z, builder.getInt32(0));
+   return builder.CreateSelect(zNegative, builder.CreateXor(z, builder.getInt32(0x7fffffff)),
+                               z, "z");
+}
+
+// tests and updates depth and stencil of one sample; depth and stencil point to the sample
+// and are NULL when the test is disabled; returns i1 true if both tests passed
+static Value * GenerateDepthStencilTest(const GGLState * gglCtx, IRBuilder<> & builder,
+                                        const DepthStencilValues & values, Value * depth,
+                                        Value * stencil)
+{
+   CondBranch condBranch(builder);
+   const bool depthPacked = values.depthPacked, stencilPacked = values.stencilPacked;
+   Value * const sFace = values.sFace, * const sRef = values.sRef, * z = values.z;
+
+   // SZ_24 depth and stencil tests of one surface share one load and one store, a separate
+   // SZ_24 stencil surface keeps its own depth bits
+   Value * dWordPtr = NULL, * dWord = NULL, * sWordPtr = NULL, * sWord = NULL;
+   if (depthPacked) {
+      dWordPtr = depth;
+      dWord = builder.CreateLoad(dWordPtr, "dWord");
+   }
+   if (stencilPacked && values.sharedWord) {
+      sWordPtr = dWordPtr;
+      sWord = dWord;
+   } else if (stencilPacked) {
+      sWordPtr = builder.CreateBitCast(stencil, PointerType::get(builder.getInt32Ty(), 0));
+      sWord = builder.CreateLoad(sWordPtr, "sWord");
+   }
+
+   Value * sCmp = builder.getTrue(), * sPtr = NULL;
+   if (gglCtx->bufferState.stencilTest) {
+      // temporaries to load/store value
+      Value * sCmpPtr = EntryAlloca(builder, builder.getInt1Ty(), "sCmpPtr");
+      sPtr = EntryAlloca(builder, builder.getInt8Ty(), "sPtr");
+
+      Value * s = NULL;
+      if (stencilPacked)
+         s = builder.CreateTrunc(builder.CreateLShr(sWord, 24), builder.getInt8Ty());
+      else
+         s = builder.CreateLoad(stencil);
+      s = builder.CreateAnd(s, values.sMask);
+      builder.CreateStore(s, sPtr);
+
+      if (gglCtx->frontStencil.func != gglCtx->backStencil.func)
+         condBranch.ifCond(builder.CreateICmpEQ(sFace, builder.getInt8(0)));
+
+      StencilFunc(builder, gglCtx->frontStencil.func, s, sRef, sCmpPtr);
+
+      if (gglCtx->frontStencil.func != gglCtx->backStencil.func) {
+         condBranch.elseop();
+         StencilFunc(builder, gglCtx->backStencil.func, s, sRef, sCmpPtr);
+         condBranch.endif();
+      }
+
+      sCmp = builder.CreateLoad(sCmpPtr, "sCmp");
+   }
+
+   Value * zCmp = builder.getTrue(); // no depth test means always pass
+   if (gglCtx->bufferState.depthTest) {
+      Value * depthZ = NULL; // z stored in buffer
+      if (depthPacked)
+         depthZ = builder.CreateAnd(dWord, builder.getInt32(0x00ffffff), "depthZ");
+      else
+         depthZ = builder.CreateLoad(depth, "depthZ");
+
+      // Z_32 is bitcast float with negative values flipped, unorm depth is unsigned
+      const bool zSigned = !depthPacked && !values.depth16;
+      switch (0x200 | gglCtx->bufferState.depthFunc) {
+      case GL_NEVER:
+         zCmp = builder.getFalse();
+         break;
+      case GL_LESS:
+         zCmp = builder.CreateICmp(zSigned ? CmpInst::ICMP_SLT : CmpInst::ICMP_ULT, z, depthZ);
+         break;
+      case GL_EQUAL:
+         zCmp = builder.CreateICmpEQ(z, depthZ);
+         break;
+      case GL_LEQUAL:
+         zCmp = builder.CreateICmp(zSigned ? CmpInst::ICMP_SLE : CmpInst::ICMP_ULE, z, depthZ);
+         break;
+      case GL_GREATER:
+         zCmp = builder.CreateICmp(zSigned ? CmpInst::ICMP_SGT : CmpInst::ICMP_UGT, z, depthZ);
+         break;
+      case GL_NOTEQUAL:
+         zCmp = builder.CreateICmpNE(z, depthZ);
+         break;
+      case GL_GEQUAL:
+         zCmp = builder.CreateICmp(zSigned ? CmpInst::ICMP_SGE : CmpInst::ICMP_UGE, z, depthZ);
+         break;
+      case GL_ALWAYS:
+         zCmp = builder.getTrue();
+         break;
+      default:
+         assert(0);
+         break;
+      }
+   }
+
+   condBranch.ifCond(sCmp, "if_sCmp", "sCmp_fail");
+   condBranch.ifCond(zCmp, "if_zCmp", "zCmp_fail");
+
+   // TODO DXL depthmask check
+   Value * sPass = NULL;
+   if (stencilPacked)
+      sPass = StencilOp(builder, sFace, gglCtx->frontStencil.dPass,
+                        gglCtx->backStencil.dPass, sPtr, sRef);
+   if (depthPacked)
+      StoreDepthStencil(builder, dWordPtr, dWord, z, values.sharedWord ? sPass : NULL);
+   if (stencilPacked && !values.sharedWord)
+      StoreDepthStencil(builder, sWordPtr, sWord, NULL, sPass);
+   if (gglCtx->bufferState.depthTest && !depthPacked)
+      builder.CreateStore(z, depth); // store z, i16 for Z_16
+
+   if (gglCtx->bufferState.stencilTest && !stencilPacked)
+      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.dPass,
+                                    gglCtx->backStencil.dPass, sPtr, sRef), stencil);
+
+   condBranch.elseop(); // failed z test
+
+   if (stencilPacked)
+      StoreDepthStencil(builder, sWordPtr, sWord, NULL,
+                        StencilOp(builder, sFace, gglCtx->frontStencil.dFail,
+                                  gglCtx->backStencil.dFail, sPtr, sRef));
+   else if (gglCtx->bufferState.stencilTest)
+      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.dFail,
+                                    gglCtx->backStencil.dFail, sPtr, sRef), stencil);
+   condBranch.endif();
+   condBranch.elseop(); // failed s test
+
+   if (stencilPacked)
+      StoreDepthStencil(builder, sWordPtr, sWord, NULL,
+                        StencilOp(builder, sFace, gglCtx->frontStencil.sFail,
+                                  gglCtx->backStencil.sFail, sPtr, sRef));
+   else if (gglCtx->bufferState.stencilTest)
+      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.sFail,
+                                    gglCtx->backStencil.sFail, sPtr, sRef), stencil);
+
+   condBranch.endif();
+   return builder.CreateAnd(sCmp, zCmp, "dsPass");
+}
+
+// calls the fragment shader on start, which holds both its inputs and outputs;
+// returns i1 true if the fragment was discarded, or NULL if the shader has no discard
+static Value * CallFragmentShader(IRBuilder<> & builder, Module * mod, const char * shaderName,
+                                  Value * start, Value * constants, const bool usesDiscard)
+{
+   Value * discarded = builder.CreateConstInBoundsGEP1_32(start,
+                       offsetof(VertexOutput,discarded)/sizeof(Vector4));
+   if (usesDiscard) // the flag is only set by discard
+      builder.CreateStore(Constant::getNullValue(floatVecType(builder)), discarded);
+
+   Function * fsFunction = mod->getFunction(shaderName);
+   assert(fsFunction);
+   CallInst *call = builder.CreateCall3(fsFunction, start, start, constants);
+   call->setCallingConv(CallingConv::C);
+   call->setTailCall(false);
+
+   if (!usesDiscard)
+      return NULL;
+   discarded = builder.CreateExtractElement(builder.CreateLoad(discarded), builder.getInt32(0));
+   return builder.CreateFCmpONE(discarded, constFloat(builder, 0), "discarded");
+}
+
 // generated scanline function parameters are VertexOutput * start, VertexOutput * step,
 // unsigned * frame, int * depth, unsigned char * stencil,
-// GGLActiveStencilState * stencilState, unsigned count
+// GGLActiveStencilState * stencilState, unsigned count, unsigned char * coverage;
+// with multisample, buffers have 4 consecutive samples per pixel and coverage has
+// a 4 bit sample mask per pixel, the shader runs once per pixel and tests run per sample
 void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program, Module * mod,
                       const char * shaderName, const char * scanlineName)
 {
@@ -486,30 +847,68 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    stencilState->setName("stencilState");
    Value * countPtr = builder.CreateAlloca(intType);
    builder.CreateStore(args++, countPtr);
+   Value * coveragePtr = builder.CreateAlloca(bytePointerType);
+   builder.CreateStore(args++, coveragePtr);
+
+   const bool multisample = gglCtx->bufferState.multisample;
+   const unsigned samples = multisample ? 4 : 1;
+   // lowp color only has the 8 bits of the color buffer, so it is packed and blended narrow
+   const bool lowp = ast_precision_low ==
+                     program->_LinkedShaders[MESA_SHADER_FRAGMENT]->FloatPrecision;
 
-   Value * sFace = NULL, * sRef = NULL, *sMask = NULL, * sFunc = NULL;
+   DepthStencilValues dsValues;
+   memset(&dsValues, 0, sizeof(dsValues));
    if (gglCtx->bufferState.stencilTest) {
-      sFace = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 0), "sFace");
+      dsValues.sFace = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 0), "sFace");
       if (gglCtx->frontStencil.ref == gglCtx->backStencil.ref)
-         sRef = builder.getInt8(gglCtx->frontStencil.ref);
+         dsValues.sRef = builder.getInt8(gglCtx->frontStencil.ref);
       else
-         sRef = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 1), "sRef");
+         dsValues.sRef = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 1), "sRef");
       if (gglCtx->frontStencil.mask == gglCtx->backStencil.mask)
-         sMask = builder.getInt8(gglCtx->frontStencil.mask);
+         dsValues.sMask = builder.getInt8(gglCtx->frontStencil.mask);
       else
-         sMask = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 2), "sMask");
-      if (gglCtx->frontStencil.func == gglCtx->backStencil.func)
-         sFunc = builder.getInt8(gglCtx->frontStencil.func);
-      else
-         sFunc = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 3), "sFunc");
+         dsValues.sMask = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(stencilState, 2), "sMask");
+   }
+
+   // ordered dither uses x & 3 and y & 3 of the fragment; y is constant for the span,
+   // and x is ditherX - count since only z is stepped unless the shader uses gl_FragCoord
+   Value * ditherRow = NULL, * ditherX = NULL;
+   if (gglCtx->bufferState.dither && GGL_PIXEL_FORMAT_RGB_565 == gglCtx->bufferState.colorFormat) {
+      Value * position = builder.CreateBitCast(start, PointerType::get(builder.getFloatTy(), 0));
+      position = builder.CreateConstInBoundsGEP1_32(position, (GGL_FS_INPUT_OFFSET +
+                 GGL_FS_INPUT_FRAGCOORD_INDEX) * 4);
+      ditherX = builder.CreateFPToUI(builder.CreateLoad(position), intType);
+      ditherX = builder.CreateAdd(ditherX, builder.CreateLoad(countPtr), "ditherX");
+      Value * y = builder.CreateLoad(builder.CreateConstInBoundsGEP1_32(position, 1));
+      y = builder.CreateFPToUI(y, intType);
+      y = builder.CreateShl(builder.CreateAnd(y, builder.getInt32(3)), builder.getInt32(4));
+      ditherRow = builder.CreateLShr(builder.getInt64(ditherMatrix),
+                                     builder.CreateZExt(y, builder.getInt64Ty()));
+      ditherRow = builder.CreateTrunc(ditherRow, intType, "ditherRow");
    }
 
+   // SZ_24 packs 24 bit unorm depth in the low bits and stencil in the high 8 bits,
+   // so both tests share one load and one store per fragment
+   dsValues.depthPacked = gglCtx->bufferState.depthTest &&
+                          GGL_PIXEL_FORMAT_SZ_24 == gglCtx->bufferState.depthFormat;
+   dsValues.stencilPacked = gglCtx->bufferState.stencilTest &&
+                            GGL_PIXEL_FORMAT_SZ_24 == gglCtx->bufferState.stencilFormat;
+   // only the same SZ_24 surface for both is one word, a separate SZ_24 stencil
+   // surface is read and written on its own, keeping its depth bits
+   dsValues.sharedWord = dsValues.depthPacked && dsValues.stencilPacked &&
+                         gglCtx->bufferState.sharedDepthStencil;
+   // Z_16 halves depth bandwidth with 16 bit unorm depth and 16 bit compares
+   dsValues.depth16 = gglCtx->bufferState.depthTest &&
+                      GGL_PIXEL_FORMAT_Z_16 == gglCtx->bufferState.depthFormat;
+
    condBranch.beginLoop(); // while (count > 0)
 
    assert(framePtr && gglCtx);
    // get values
    Value * frame = NULL;
-   if (GGL_PIXEL_FORMAT_RGBA_8888 == gglCtx->bufferState.colorFormat)
+   if (GGL_PIXEL_FORMAT_RGBA_8888 == gglCtx->bufferState.colorFormat ||
+         GGL_PIXEL_FORMAT_BGRA_8888 == gglCtx->bufferState.colorFormat ||
+         GGL_PIXEL_FORMAT_RGBX_8888 == gglCtx->bufferState.colorFormat)
       frame = builder.CreateLoad(framePtr);
    else if (GGL_PIXEL_FORMAT_RGB_565 == gglCtx->bufferState.colorFormat) {
       frame = builder.CreateLoad(framePtr);
@@ -522,8 +921,11 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    frame->setName("frame");
    Value * depth = NULL, * stencil = NULL;
    if (gglCtx->bufferState.depthTest) {
-      assert(GGL_PIXEL_FORMAT_Z_32 == gglCtx->bufferState.depthFormat);
+      assert(GGL_PIXEL_FORMAT_Z_32 == gglCtx->bufferState.depthFormat ||
+             GGL_PIXEL_FORMAT_SZ_24 == gglCtx->bufferState.depthFormat || dsValues.depth16);
       depth = builder.CreateLoad(depthPtr);
+      if (dsValues.depth16)
+         depth = builder.CreateBitCast(depth, PointerType::get(builder.getInt16Ty(), 0));
       depth->setName("depth");
    }
 
@@ -535,156 +937,108 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    condBranch.brk(); // break;
    condBranch.endif();
 
-   Value * sCmpPtr = NULL, * sCmp = NULL, * sPtr = NULL, * s = NULL;
    if (gglCtx->bufferState.stencilTest) {
       stencil = builder.CreateLoad(stencilPtr);
       stencil->setName("stencil");
+   }
+   if (gglCtx->bufferState.depthTest)
+      dsValues.z = GenerateFragmentZ(builder, start, dsValues);
+
+   // shaders that may discard run before the depth and stencil tests, which write
+   // the buffers; other shaders only run for fragments that passed
+   if (program->UsesDiscard) {
+      Value * discarded = CallFragmentShader(builder, mod, shaderName, start, constants, true);
+      condBranch.ifCond(builder.CreateNot(discarded), "if_not_discarded", "discarded");
+   }
 
-      // temporaries to load/store value
-      sCmpPtr = builder.CreateAlloca(builder.getInt1Ty());
-      sCmpPtr->setName("sCmpPtr");
-      sPtr = builder.CreateAlloca(byteType);
-      sPtr->setName("sPtr");
-
-      s = builder.CreateLoad(stencil);
-      s = builder.CreateAnd(s, sMask);
-      builder.CreateStore(s, sPtr);
-
-      if (gglCtx->frontStencil.func != gglCtx->backStencil.func)
-         condBranch.ifCond(builder.CreateICmpEQ(sFace, builder.getInt8(0)));
-
-      StencilFunc(builder, gglCtx->frontStencil.func, s, sRef, sCmpPtr);
-
-      if (gglCtx->frontStencil.func != gglCtx->backStencil.func) {
-         condBranch.elseop();
-         StencilFunc(builder, gglCtx->backStencil.func, s, sRef, sCmpPtr);
+   Value * coverage = NULL, * passMaskPtr = NULL, * pass = NULL;
+   if (!multisample)
+      pass = GenerateDepthStencilTest(gglCtx, builder, dsValues, depth, stencil);
+   else {
+      coverage = builder.CreateLoad(coveragePtr, "coverage");
+      Value * sampleMask = builder.CreateLoad(coverage, "sampleMask");
+      passMaskPtr = EntryAlloca(builder, byteType, "passMaskPtr");
+      builder.CreateStore(builder.getInt8(0), passMaskPtr);
+      for (unsigned i = 0; i < samples; i++) {
+         Value * covered = builder.CreateAnd(sampleMask, builder.getInt8(1 << i));
+         condBranch.ifCond(builder.CreateICmpNE(covered, builder.getInt8(0)), "if_covered");
+         Value * samplePass = GenerateDepthStencilTest(gglCtx, builder, dsValues,
+                              depth ? builder.CreateConstInBoundsGEP1_32(depth, i) : NULL,
+                              stencil ? builder.CreateConstInBoundsGEP1_32(stencil,
+                                    dsValues.stencilPacked ? i * 4 : i) : NULL);
+         samplePass = builder.CreateShl(builder.CreateZExt(samplePass, byteType), i);
+         builder.CreateStore(builder.CreateOr(builder.CreateLoad(passMaskPtr), samplePass),
+                             passMaskPtr);
          condBranch.endif();
       }
-
-      sCmp = builder.CreateLoad(sCmpPtr);
-   } else
-      sCmp = ConstantInt::getTrue(mod->getContext());
-   sCmp->setName("sCmp");
-
-   Value * depthZ = NULL, * zPtr = NULL, * z = NULL, * zCmp = NULL;
-   if (gglCtx->bufferState.depthTest) {
-      depthZ  = builder.CreateLoad(depth, "depthZ"); // z stored in buffer
-      zPtr = builder.CreateAlloca(intType); // temp store for modifying incoming z
-      zPtr->setName("zPtr");
-
-      // modified incoming z
-      z = builder.CreateBitCast(start, intPointerType);
-      z = builder.CreateConstInBoundsGEP1_32(z, (GGL_FS_INPUT_OFFSET +
-                                             GGL_FS_INPUT_FRAGCOORD_INDEX) * 4 + 2);
-      z = builder.CreateLoad(z, "z");
-
-      builder.CreateStore(z, zPtr);
-
-      Value * zNegative = builder.CreateICmpSLT(z, builder.getInt32(0));
-      condBranch.ifCond(zNegative);
-      // if (0x80000000 & z) z ^= 0x7fffffff since smaller -ve float means bigger -ve int
-      z = builder.CreateXor(z, builder.getInt32(0x7fffffff));
-      builder.CreateStore(z, zPtr);
-
-      condBranch.endif();
-
-      z = builder.CreateLoad(zPtr, "z");
-
-      switch (0x200 | gglCtx->bufferState.depthFunc) {
-      case GL_NEVER:
-         zCmp = ConstantInt::getFalse(mod->getContext());
-         break;
-      case GL_LESS:
-         zCmp = builder.CreateICmpSLT(z, depthZ);
-         break;
-      case GL_EQUAL:
-         zCmp = builder.CreateICmpEQ(z, depthZ);
-         break;
-      case GL_LEQUAL:
-         zCmp = builder.CreateICmpSLE(z, depthZ);
-         break;
-      case GL_GREATER:
-         zCmp = builder.CreateICmpSGT(z, depthZ);
-         break;
-      case GL_NOTEQUAL:
-         zCmp = builder.CreateICmpNE(z, depthZ);
-         break;
-      case GL_GEQUAL:
-         zCmp = builder.CreateICmpSGE(z, depthZ);
-         break;
-      case GL_ALWAYS:
-         zCmp = ConstantInt::getTrue(mod->getContext());
-         break;
-      default:
-         assert(0);
-         break;
-      }
-   } else // no depth test means always pass
-      zCmp = ConstantInt::getTrue(mod->getContext());
-   zCmp->setName("zCmp");
-
-   condBranch.ifCond(sCmp, "if_sCmp", "sCmp_fail");
-   condBranch.ifCond(zCmp, "if_zCmp", "zCmp_fail");
-
-   Value * inputs = start;
-   Value * outputs = start;
-
-   Value * fsOutputs = builder.CreateConstInBoundsGEP1_32(start,
-                       offsetof(VertexOutput,fragColor)/sizeof(Vector4));
-
-   Function * fsFunction = mod->getFunction(shaderName);
-   assert(fsFunction);
-   CallInst *call = builder.CreateCall3(fsFunction,inputs, outputs, constants);
-   call->setCallingConv(CallingConv::C);
-   call->setTailCall(false);
-
-   Value * dst = Constant::getNullValue(intVecType(builder));
-   if (gglCtx->blendState.enable && (0 != gglCtx->blendState.dcf || 0 != gglCtx->blendState.daf)) {
-      Value * frameColor = builder.CreateLoad(frame, "frameColor");
-      dst = ScreenColorToIntVector(builder, gglCtx->bufferState.colorFormat, frameColor);
+      pass = builder.CreateICmpNE(builder.CreateLoad(passMaskPtr), builder.getInt8(0));
    }
 
-   Value * src = builder.CreateConstInBoundsGEP1_32(fsOutputs, 0);
+   condBranch.ifCond(pass, "if_pass", "pass_end");
+
+   if (!program->UsesDiscard)
+      CallFragmentShader(builder, mod, shaderName, start, constants, false);
+   Value * src = builder.CreateConstInBoundsGEP1_32(start,
+                 offsetof(VertexOutput,fragColor)/sizeof(Vector4));
    src = builder.CreateLoad(src);
 
-   Value * color = GenerateFSBlend(gglCtx, gglCtx->bufferState.colorFormat,/*&prog->outputRegDesc,*/ builder, src, dst);
-   builder.CreateStore(color, frame);
-   // TODO DXL depthmask check
-   if (gglCtx->bufferState.depthTest) {
-      z = builder.CreateBitCast(z, intType);
-      builder.CreateStore(z, depth); // store z
+   Value * dither = NULL;
+   if (ditherRow) {
+      Value * x = builder.CreateSub(ditherX, count);
+      x = builder.CreateShl(builder.CreateAnd(x, builder.getInt32(3)), builder.getInt32(2));
+      dither = builder.CreateAnd(builder.CreateLShr(ditherRow, x), builder.getInt32(15), "dither");
    }
 
-   if (gglCtx->bufferState.stencilTest)
-      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.dPass,
-                                    gglCtx->backStencil.dPass, sPtr, sRef), stencil);
-
-   condBranch.elseop(); // failed z test
-
-   if (gglCtx->bufferState.stencilTest)
-      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.dFail,
-                                    gglCtx->backStencil.dFail, sPtr, sRef), stencil);
-   condBranch.endif();
-   condBranch.elseop(); // failed s test
+   const bool readsFrame = gglCtx->blendState.enable &&
+                           (0 != gglCtx->blendState.dcf || 0 != gglCtx->blendState.daf);
+   Value * const zeroDst = Constant::getNullValue(intVecType(builder));
+   // without blending the color is the same for every sample
+   Value * color = NULL;
+   if (!readsFrame)
+      color = GenerateFSBlend(gglCtx, gglCtx->bufferState.colorFormat,/*&prog->outputRegDesc,*/
+                              builder, src, zeroDst, dither, lowp);
+   Value * passMask = multisample ? builder.CreateLoad(passMaskPtr, "passMask") : NULL;
+   for (unsigned i = 0; i < samples; i++) {
+      if (multisample) {
+         Value * passed = builder.CreateAnd(passMask, builder.getInt8(1 << i));
+         condBranch.ifCond(builder.CreateICmpNE(passed, builder.getInt8(0)), "if_passed");
+      }
+      Value * sample = builder.CreateConstInBoundsGEP1_32(frame, i);
+      if (readsFrame) {
+         Value * frameColor = builder.CreateLoad(sample, "frameColor");
+         Value * dst = ScreenColorToIntVector(builder, gglCtx->bufferState.colorFormat, frameColor);
+         color = GenerateFSBlend(gglCtx, gglCtx->bufferState.colorFormat, builder, src, dst,
+                                 dither, lowp);
+      }
+      builder.CreateStore(color, sample);
+      if (multisample)
+         condBranch.endif();
+   }
 
-   if (gglCtx->bufferState.stencilTest)
-      builder.CreateStore(StencilOp(builder, sFace, gglCtx->frontStencil.sFail,
-                                    gglCtx->backStencil.sFail, sPtr, sRef), stencil);
+   condBranch.endif(); // pass
+   if (program->UsesDiscard)
+      condBranch.endif(); // not discarded
 
-   condBranch.endif();
    assert(frame);
-   frame = builder.CreateConstInBoundsGEP1_32(frame, 1); // frame++
+   frame = builder.CreateConstInBoundsGEP1_32(frame, samples); // frame++
    // frame may have been casted to short* from int*, so cast back
    frame = builder.CreateBitCast(frame, PointerType::get(builder.getInt32Ty(), 0));
    builder.CreateStore(frame, framePtr);
    if (gglCtx->bufferState.depthTest) {
-      depth = builder.CreateConstInBoundsGEP1_32(depth, 1); // depth++
+      depth = builder.CreateConstInBoundsGEP1_32(depth, samples); // depth++
+      // depth may have been casted to short* for Z_16, so cast back
+      depth = builder.CreateBitCast(depth, intPointerType);
       builder.CreateStore(depth, depthPtr);
    }
    if (gglCtx->bufferState.stencilTest) {
-      stencil = builder.CreateConstInBoundsGEP1_32(stencil, 1); // stencil++
+      // stencil++, SZ_24 stencil is in 4 byte pixels
+      stencil = builder.CreateConstInBoundsGEP1_32(stencil, samples *
+                (dsValues.stencilPacked ? 4 : 1));
       builder.CreateStore(stencil, stencilPtr);
    }
+   if (multisample)
+      builder.CreateStore(builder.CreateConstInBoundsGEP1_32(coverage, 1), coveragePtr);
+
    Value * vPtr = NULL, * v = NULL, * dx = NULL;
    if (program->UsesFragCoord) {
       vPtr = builder.CreateConstInBoundsGEP1_32(start, GGL_FS_INPUT_OFFSET +
@@ -737,4 +1091,14 @@ void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program
    condBranch.endLoop();
 
    builder.CreateRetVoid();
+
+   // inlined into the span loop, so GGL_SHADER_PASS_LICM can hoist the shader's
+   // sampler descriptor loads out of it
+   Function * fsFunction = mod->getFunction(shaderName);
+   assert(fsFunction->hasOneUse());
+   if (CallInst * call = dyn_cast<CallInst>(*fsFunction->use_begin())) {
+      InlineFunctionInfo inlineInfo;
+      if (!InlineFunction(call, inlineInfo))
+         ALOGD("pf2: GenerateScanLine failed to inline '%s'", shaderName);
+   }
 }
@@ -139,43 +139,164 @@ static Value * pointSample(IRBuilder<> & builder, Value * textureData, Value * i
 
 static const unsigned SHIFT = 16;
 
-// w  = width - 1, h = height - 1; similar to pointSample; returns <4 x i32> rgba
-static Value * linearSample(IRBuilder<> & builder, Value * textureData, Value * indexOffset,
+// mirrors GGLSamplerDescriptor
+static StructType * SamplerDescriptorType(IRBuilder<> & builder)
+{
+   Type * const intType = builder.getInt32Ty();
+   std::vector<Type *> fields;
+   fields.push_back(PointerType::get(intType, 0)); // data
+   fields.push_back(intType); // width
+   fields.push_back(intType); // height
+   fields.push_back(intType); // widthMask
+   fields.push_back(intType); // heightMask
+   fields.push_back(intType); // widthShift
+   fields.push_back(intType); // stride
+   fields.push_back(intType); // faceSize
+   fields.push_back(intType); // maxLevel
+   fields.push_back(ArrayType::get(intType, GGL_MAX_TEXTURE_LEVELS)); // levelOffsets
+   return StructType::get(builder.getContext(), fields);
+}
+
+// values from GGLSamplerDescriptor used for addressing
+struct SamplerValues {
+   Value * data, * width, * height, * widthMask, * heightMask;
+   Value * widthShift, * stride, * faceSize;
+   bool pot; // power of 2 dimensions, known at jit time from ShaderKey
+};
+
+static Value * SamplersGlobal(IRBuilder<> & builder)
+{
+   Module * module = builder.GetInsertBlock()->getParent()->getParent();
+   Value * samplers = module->getGlobalVariable(_PF2_TEXTURE_SAMPLERS_NAME_);
+   if (!samplers)
+      samplers = new GlobalVariable(*module, SamplerDescriptorType(builder), true,
+                                    GlobalValue::ExternalLinkage, NULL, _PF2_TEXTURE_SAMPLERS_NAME_);
+   return samplers;
+}
+
+// descriptors are a constant global; the fragment shader is inlined into the scanline,
+// where GGL_SHADER_PASS_LICM hoists these loads out of the span loop
+static void LoadSampler(IRBuilder<> & builder, const unsigned sampler, const GGLState * gglCtx,
+                        SamplerValues * values)
+{
+   Value * samplers = SamplersGlobal(builder);
+   values->data = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 0),
+                                     name("textureData"));
+   values->width = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 1),
+                                      name("textureWidth"));
+   values->height = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 2),
+                                       name("textureHeight"));
+   values->widthMask = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 3),
+                                          name("textureW"));
+   values->heightMask = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 4),
+                                           name("textureH"));
+   values->widthShift = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 5),
+                                           name("textureWidthShift"));
+   values->stride = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 6),
+                                       name("textureStride"));
+   values->faceSize = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 7),
+                                         name("textureFaceSize"));
+   values->pot = TexturePowerOf2(gglCtx->textureState.textures + sampler);
+}
+
+// log2 of the larger texel footprint of the coordinate gradients; the exponent bits of
+// the squared footprint are accurate enough to pick the nearest level
+static Value * GradientLod(IRBuilder<> & builder, Value * dPdx, Value * dPdy,
+                           const std::vector<Value *> & size)
+{
+   const std::vector<Value *> gradients[2] = {extractVector(builder, dPdx),
+                                              extractVector(builder, dPdy)
+                                             };
+   Value * rho2[2] = {NULL, NULL};
+   for (unsigned i = 0; i < 2; i++)
+      for (unsigned j = 0; j < size.size(); j++) {
+         Value * texels = builder.CreateFMul(gradients[i][j], size[j]);
+         texels = builder.CreateFMul(texels, texels);
+         rho2[i] = rho2[i] ? builder.CreateFAdd(rho2[i], texels) : texels;
+      }
+   Value * rho = builder.CreateSelect(builder.CreateFCmpOGT(rho2[0], rho2[1]), rho2[0], rho2[1]);
+   rho = builder.CreateSIToFP(builder.CreateBitCast(rho, builder.getInt32Ty()), builder.getFloatTy());
+   rho = builder.CreateFSub(builder.CreateFMul(rho, constFloat(builder, 1.0f / (1 << 23))),
+                            constFloat(builder, 127));
+   return builder.CreateFMul(rho, constFloat(builder, 0.5f), name("gradientLod"));
+}
+
+// narrows sv to the level nearest lod, like GL_*_MIPMAP_NEAREST with the texture filter
+// used within the level; returns the texel offset of face 0 of the level
+static Value * SelectLevel(IRBuilder<> & builder, SamplerValues * sv, const unsigned sampler,
+                           Value * lod)
+{
+   Value * samplers = SamplersGlobal(builder);
+   Value * maxLevel = builder.CreateLoad(builder.CreateConstInBoundsGEP2_32(samplers, sampler, 8),
+                                         name("textureMaxLevel"));
+   Value * level = builder.CreateFAdd(lod, constFloat(builder, 0.5f));
+   level = builder.CreateFPToSI(level, builder.getInt32Ty());
+   level = maxIntScalar(builder, level, builder.getInt32(0));
+   level = minIntScalar(builder, level, maxLevel);
+
+   // levels are tightly packed, and mipmapped textures are power of 2
+   Value * const one = builder.getInt32(1);
+   sv->width = maxIntScalar(builder, builder.CreateLShr(sv->width, level), one);
+   sv->height = maxIntScalar(builder, builder.CreateLShr(sv->height, level), one);
+   sv->widthMask = builder.CreateSub(sv->width, one, name("levelW"));
+   sv->heightMask = builder.CreateSub(sv->height, one, name("levelH"));
+   sv->widthShift = maxIntScalar(builder, builder.CreateSub(sv->widthShift, level),
+                                 builder.getInt32(0));
+   sv->stride = sv->width;
+   sv->faceSize = builder.CreateMul(sv->width, sv->height);
+
+   Value * index[3] = {builder.getInt32(sampler), builder.getInt32(9), level};
+   return builder.CreateLoad(builder.CreateInBoundsGEP(samplers, index), name("levelOffset"));
+}
+
+// linear texel index of x, y; shift instead of multiply for power of 2 textures
+static Value * texelIndex(IRBuilder<> & builder, const SamplerValues & sv, Value * x, Value * y)
+{
+   Value * row = sv.pot ? builder.CreateShl(y, sv.widthShift) : builder.CreateMul(y, sv.stride);
+   return builder.CreateAdd(row, x);
+}
+
+// neighbouring texel coordinate for linear filter
+static Value * texelNext(IRBuilder<> & builder, const SamplerValues & sv, const unsigned wrap,
+                         Value * tc, Value * mask)
+{
+   tc = builder.CreateAdd(tc, builder.getInt32(1));
+   if (sv.pot && 0 == wrap) // GL_REPEAT wraps around to first texel
+      return builder.CreateAnd(tc, mask);
+   return minIntScalar(builder, tc, mask);
+}
+
+// similar to pointSample; returns <4 x i32> rgba
+static Value * linearSample(IRBuilder<> & builder, const SamplerValues & sv, Value * indexOffset,
                             Value * x0, Value * y0, Value * xLerp, Value * yLerp,
-                            Value * w, Value * h,  Value * width, Value * height,
+                            const unsigned wrapS, const unsigned wrapT,
                             const GGLPixelFormat format/*, const RegDesc * dstDesc*/)
 {
    // TODO: linear filtering needs to be fixed for texcoord outside of [0,1]
-   Value * x1 = builder.CreateAdd(x0, builder.getInt32(1));
-   x1 = minIntScalar(builder, x1, w);
-   Value * y1 = builder.CreateAdd(y0, builder.getInt32(1));
-   y1 = minIntScalar(builder, y1, h);
+   Value * x1 = texelNext(builder, sv, wrapS, x0, sv.widthMask);
+   Value * y1 = texelNext(builder, sv, wrapT, y0, sv.heightMask);
 
 //   RegDesc regDesc;
 //   regDesc.SetVectorType(Fixed8);
 
-   Value * index = builder.CreateMul(y0, width);
-   index = builder.CreateAdd(index, x0);
+   Value * index = texelIndex(builder, sv, x0, y0);
    index = builder.CreateAdd(index, indexOffset);
-   Value * s0 = pointSample(builder, textureData, index, format/*, &regDesc*/);
+   Value * s0 = pointSample(builder, sv.data, index, format/*, &regDesc*/);
 //   s0 = builder.CreateBitCast(s0, intVecType(builder));
 
-   index = builder.CreateMul(y0, width);
-   index = builder.CreateAdd(index, x1);
+   index = texelIndex(builder, sv, x1, y0);
    index = builder.CreateAdd(index, indexOffset);
-   Value * s1 = pointSample(builder, textureData, index, format/*, &regDesc*/);
+   Value * s1 = pointSample(builder, sv.data, index, format/*, &regDesc*/);
 //   s1 = builder.CreateBitCast(s1, intVecType(builder));
 
-   index = builder.CreateMul(y1, width);
-   index = builder.CreateAdd(index, x1);
+   index = texelIndex(builder, sv, x1, y1);
    index = builder.CreateAdd(index, indexOffset);
-   Value * s2 = pointSample(builder, textureData, index, format/*, &regDesc*/);
+   Value * s2 = pointSample(builder, sv.data, index, format/*, &regDesc*/);
 //   s2 = builder.CreateBitCast(s2, intVecType(builder));
 
-   index = builder.CreateMul(y1, width);
-   index = builder.CreateAdd(index, x0);
+   index = texelIndex(builder, sv, x0, y1);
    index = builder.CreateAdd(index, indexOffset);
-   Value * s3 = pointSample(builder, textureData, index, format/*, &regDesc*/);
+   Value * s3 = pointSample(builder, sv.data, index, format/*, &regDesc*/);
 //   s3 = builder.CreateBitCast(s3, intVecType(builder));
 
    Value * xLerpVec = intVec(builder, xLerp, xLerp, xLerp, xLerp);
@@ -271,63 +392,43 @@ static Value * texcoordWrap(IRBuilder<> & builder, const unsigned wrap,
    return tc;
 }
 
+// lod is explicit or the bias added to the implicit LOD, which is the base level since there
+// are no derivatives in the scanline; dPdx and dPdy are explicit gradients instead of lod
 Value * tex2D(IRBuilder<> & builder, Value * in1, const unsigned sampler,
               /*const RegDesc * in1Desc, const RegDesc * dstDesc,*/
-              const GGLState * gglCtx)
+              const GGLState * gglCtx, Value * lod, Value * dPdx, Value * dPdy)
 {
-   Type * intType = builder.getInt32Ty();
-   PointerType * intPointerType = PointerType::get(intType, 0);
-
-   llvm::Module * module = builder.GetInsertBlock()->getParent()->getParent();
    std::vector<Value * > texcoords = extractVector(builder, in1);
 
-   Value * textureDimensions = module->getGlobalVariable(_PF2_TEXTURE_DIMENSIONS_NAME_);
-   if (!textureDimensions)
-      textureDimensions = new GlobalVariable(*module, intType, true,
-                                             GlobalValue::ExternalLinkage,
-                                             NULL, _PF2_TEXTURE_DIMENSIONS_NAME_);
-   Value * textureWidth = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                          sampler * 2);
-   textureWidth = builder.CreateLoad(textureWidth, name("textureWidth"));
-   Value * textureHeight = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                           sampler * 2 + 1);
-   textureHeight = builder.CreateLoad(textureHeight, name("textureHeight"));
-   Value * textureW = builder.CreateSub(textureWidth, builder.getInt32(1));
-   Value * textureH = builder.CreateSub(textureHeight, builder.getInt32(1));
+   SamplerValues sv;
+   LoadSampler(builder, sampler, gglCtx, &sv);
+   if (dPdx) {
+      std::vector<Value *> size;
+      size.push_back(builder.CreateSIToFP(sv.width, builder.getFloatTy()));
+      size.push_back(builder.CreateSIToFP(sv.height, builder.getFloatTy()));
+      lod = GradientLod(builder, dPdx, dPdy, size);
+   }
+   Value * indexOffset = lod ? SelectLevel(builder, &sv, sampler, lod) : builder.getInt32(0);
 //   ChannelType sType = Float, tType = Float;
 //   if (in1Desc) {
 //      sType = in1Desc->channels[0];
 //      tType = in1Desc->channels[1];
 //   }
 
+   const GGLTexture & texture = gglCtx->textureState.textures[sampler];
    Value * xLerp = NULL, * yLerp = NULL;
-   Value * x = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapS,
-                            /*sType, */texcoords[0], textureWidth, textureW, &xLerp);
-   Value * y = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapT,
-                            /*tType, */texcoords[1], textureHeight, textureH, &yLerp);
-
-   Value * index = builder.CreateMul(y, textureWidth);
-   index = builder.CreateAdd(index, x);
-
-   Value * textureData = module->getGlobalVariable(_PF2_TEXTURE_DATA_NAME_);
-   if (!textureData)
-      textureData = new GlobalVariable(*module, intPointerType,
-                                       true, GlobalValue::ExternalLinkage,
-                                       NULL, _PF2_TEXTURE_DATA_NAME_);
-
-   textureData = builder.CreateConstInBoundsGEP1_32(textureData, sampler);
-   textureData = builder.CreateLoad(textureData);
-
-   if (0 == gglCtx->textureState.textures[sampler].minFilter &&
-         0 == gglCtx->textureState.textures[sampler].magFilter) { // GL_NEAREST
-      Value * ret = pointSample(builder, textureData, index,
-                                gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
+   Value * x = texcoordWrap(builder, texture.wrapS,
+                            /*sType, */texcoords[0], sv.width, sv.widthMask, &xLerp);
+   Value * y = texcoordWrap(builder, texture.wrapT,
+                            /*tType, */texcoords[1], sv.height, sv.heightMask, &yLerp);
+
+   if (0 == texture.minFilter && 0 == texture.magFilter) { // GL_NEAREST
+      Value * index = builder.CreateAdd(indexOffset, texelIndex(builder, sv, x, y));
+      Value * ret = pointSample(builder, sv.data, index, texture.format/*, dstDesc*/);
       return intColorVecToFloatColorVec(builder, ret);
-   } else if (1 == gglCtx->textureState.textures[sampler].minFilter &&
-              1 == gglCtx->textureState.textures[sampler].magFilter) { // GL_LINEAR
-      Value * ret = linearSample(builder, textureData, builder.getInt32(0), x, y, xLerp, yLerp,
-                                 textureW, textureH,  textureWidth, textureHeight,
-                                 gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
+   } else if (1 == texture.minFilter && 1 == texture.magFilter) { // GL_LINEAR
+      Value * ret = linearSample(builder, sv, indexOffset, x, y, xLerp, yLerp,
+                                 texture.wrapS, texture.wrapT, texture.format/*, dstDesc*/);
       return intColorVecToFloatColorVec(builder, ret);
    } else
       assert(!"unsupported texture filter");
@@ -363,168 +464,75 @@ static Value * Fabs(IRBuilder<> & builder, Value * val)
 
 Value * texCube(IRBuilder<> & builder, Value * in1, const unsigned sampler,
                 /*const RegDesc * in1Desc, const RegDesc * dstDesc,*/
-                const GGLState * gglCtx)
+                const GGLState * gglCtx, Value * lod, Value * dPdx, Value * dPdy)
 {
 //   if (in1Desc) // the major axis determination code is only float for now
 //      assert(in1Desc->IsVectorType(Float));
 
-   Type * const intType = builder.getInt32Ty();
-   PointerType * const intPointerType = PointerType::get(intType, 0);
-   Type * const floatType = builder.getFloatTy();
-
-   Constant * const float1 = constFloat(builder, 1.0f);
    Constant * const float0_5 = constFloat(builder, 0.5f);
 
-   Module * module = builder.GetInsertBlock()->getParent()->getParent();
    std::vector<Value * > texcoords = extractVector(builder, in1);
 
-   Value * textureDimensions = module->getGlobalVariable(_PF2_TEXTURE_DIMENSIONS_NAME_);
-   if (!textureDimensions)
-      textureDimensions = new GlobalVariable(*module, intType, true,
-                                             GlobalValue::ExternalLinkage,
-                                             NULL, _PF2_TEXTURE_DIMENSIONS_NAME_);
-   Value * textureWidth = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                          sampler * 2);
-   textureWidth = builder.CreateLoad(textureWidth, name("textureWidth"));
-   Value * textureHeight = builder.CreateConstInBoundsGEP1_32(textureDimensions,
-                           sampler * 2 + 1);
-   textureHeight = builder.CreateLoad(textureHeight, name("textureHeight"));
-   Value * textureW = builder.CreateSub(textureWidth, builder.getInt32(1));
-   Value * textureH = builder.CreateSub(textureHeight, builder.getInt32(1));
+   SamplerValues sv;
+   LoadSampler(builder, sampler, gglCtx, &sv);
+   const GGLTexture & texture = gglCtx->textureState.textures[sampler];
 
    Value * mx = Fabs(builder, texcoords[0]), * my = Fabs(builder, texcoords[1]);
    Value * mz = Fabs(builder, texcoords[2]);
-   Value * sPtr = builder.CreateAlloca(floatType);
-   Value * tPtr = builder.CreateAlloca(floatType);
-   Value * maPtr = builder.CreateAlloca(floatType);
-   Value * facePtr = builder.CreateAlloca(intType);
-
-   Value * mxGmyCmp = FCmpGT(builder, mx, my);
-   Value * mxGmzCmp = FCmpGT(builder, mx, mz);
-
-   CondBranch condBranch(builder);
-   condBranch.ifCond(builder.CreateAnd(mxGmyCmp, mxGmzCmp)); // if (mx > my && mx > mz)
-//   m_storage->setCurrentBlock(currentBlock(), false);
-   {
-      condBranch.ifCond(FPositive(builder, texcoords[0]));
-//      m_storage->setCurrentBlock(currentBlock(), false);
-      {
-         builder.CreateStore(builder.CreateFNeg(texcoords[2]), sPtr);
-         builder.CreateStore(builder.CreateFNeg(texcoords[1]), tPtr);
-         builder.CreateStore(builder.getInt32(0), facePtr);
-      }
-      condBranch.elseop();
-//      m_storage->setCurrentBlock(currentBlock(), false);
-      {
-         builder.CreateStore((texcoords[2]), sPtr);
-         builder.CreateStore(builder.CreateFNeg(texcoords[1]), tPtr);
-         builder.CreateStore(builder.getInt32(1), facePtr);
-      }
-      condBranch.endif(); // end if (x >= 0)
-//      m_storage->setCurrentBlock(currentBlock(), false);
 
-      builder.CreateStore(mx, maPtr);
+   // major axis and face are selected without branches, so this stays straight line code
+   Value * xMajor = builder.CreateAnd(FCmpGT(builder, mx, my), FCmpGT(builder, mx, mz), name("xMajor"));
+   Value * yMajor = builder.CreateAnd(FCmpGT(builder, my, mx), FCmpGT(builder, my, mz));
+   yMajor = builder.CreateAnd(builder.CreateNot(xMajor), yMajor, name("yMajor"));
+   Value * xPositive = FPositive(builder, texcoords[0]);
+   Value * yPositive = FPositive(builder, texcoords[1]);
+   Value * zPositive = FPositive(builder, texcoords[2]);
+   Value * negX = builder.CreateFNeg(texcoords[0]);
+   Value * negY = builder.CreateFNeg(texcoords[1]);
+   Value * negZ = builder.CreateFNeg(texcoords[2]);
+
+   // +x: (-z, -y), -x: (z, -y), +y: (x, z), -y: (x, -z), +z: (x, -y), -z: (-x, -y)
+   Value * xS = builder.CreateSelect(xPositive, negZ, texcoords[2]);
+   Value * zS = builder.CreateSelect(zPositive, texcoords[0], negX);
+   Value * s = builder.CreateSelect(xMajor, xS, builder.CreateSelect(yMajor, texcoords[0], zS));
+   Value * yT = builder.CreateSelect(yPositive, texcoords[2], negZ);
+   Value * t = builder.CreateSelect(yMajor, yT, negY);
+   Value * ma = builder.CreateSelect(xMajor, mx, builder.CreateSelect(yMajor, my, mz));
+
+   Value * face = builder.CreateSelect(zPositive, builder.getInt32(4), builder.getInt32(5));
+   face = builder.CreateSelect(yMajor, builder.CreateSelect(yPositive, builder.getInt32(2),
+                               builder.getInt32(3)), face);
+   face = builder.CreateSelect(xMajor, builder.CreateSelect(xPositive, builder.getInt32(0),
+                               builder.getInt32(1)), face, name("face"));
+
+   // (s / ma + 1) * 0.5 with one division for both coordinates
+   Value * scale = builder.CreateFDiv(float0_5, ma);
+   s = builder.CreateFAdd(builder.CreateFMul(s, scale), float0_5);
+   t = builder.CreateFAdd(builder.CreateFMul(t, scale), float0_5);
+
+   if (dPdx) { // direction gradients are projected onto the face like the coordinates
+      Value * texels = builder.CreateFMul(scale, builder.CreateSIToFP(sv.width, builder.getFloatTy()));
+      lod = GradientLod(builder, dPdx, dPdy, std::vector<Value *>(3, texels));
    }
-   condBranch.elseop(); // !(mx > my && mx > mz)
-//   m_storage->setCurrentBlock(currentBlock(), false);
-   {
-      Value * myGmxCmp = FCmpGT(builder, my, mx);
-      Value * myGmzCmp = FCmpGT(builder, my, mz);
-      condBranch.ifCond(builder.CreateAnd(myGmxCmp, myGmzCmp)); // my > mx && my > mz
-//      m_storage->setCurrentBlock(currentBlock(), false);
-      {
-         condBranch.ifCond(FPositive(builder, texcoords[1]));
-//         m_storage->setCurrentBlock(currentBlock(), false);
-         {
-            builder.CreateStore((texcoords[0]), sPtr);
-            builder.CreateStore((texcoords[2]), tPtr);
-            builder.CreateStore(builder.getInt32(2), facePtr);
-         }
-         condBranch.elseop();
-//         m_storage->setCurrentBlock(currentBlock(), false);
-         {
-            builder.CreateStore(texcoords[0], sPtr);
-            builder.CreateStore(builder.CreateFNeg(texcoords[2]), tPtr);
-            builder.CreateStore(builder.getInt32(3), facePtr);
-         }
-         condBranch.endif();
-//         m_storage->setCurrentBlock(currentBlock(), false);
-
-         builder.CreateStore(my, maPtr);
-      }
-      condBranch.elseop(); // !(my > mx && my > mz)
-//      m_storage->setCurrentBlock(currentBlock(), false);
-      {
-         //ifCond(builder.CreateFCmpOGE(texcoords[2], float0, name("zPositive")));
-         condBranch.ifCond(FPositive(builder, texcoords[2]));
-//         m_storage->setCurrentBlock(currentBlock(), false);
-         {
-            builder.CreateStore((texcoords[0]), sPtr);
-            builder.CreateStore(builder.CreateFNeg(texcoords[1]), tPtr);
-            builder.CreateStore(builder.getInt32(4), facePtr);
-         }
-         condBranch.elseop();
-//        m_storage->setCurrentBlock(currentBlock(), false);
-         {
-            builder.CreateStore(builder.CreateFNeg(texcoords[0]), sPtr);
-            builder.CreateStore(builder.CreateFNeg(texcoords[1]), tPtr);
-            builder.CreateStore(builder.getInt32(5), facePtr);
-         }
-         condBranch.endif(); // end if (x >= 0)
-//         m_storage->setCurrentBlock(currentBlock(), false);
-
-         builder.CreateStore(mz, maPtr);
-      }
-      condBranch.endif();
-//      m_storage->setCurrentBlock(currentBlock(), false);
-   }
-   condBranch.endif();
-//   m_storage->setCurrentBlock(currentBlock(), false);
-
-
-   Value * s = builder.CreateLoad(sPtr);
-   Value * t = builder.CreateLoad(tPtr);
-   Value * ma = builder.CreateLoad(maPtr);
-   Value * face = builder.CreateLoad(facePtr);
-
-   s = builder.CreateFDiv(s, ma);
-   s = builder.CreateFAdd(s, float1);
-   s = builder.CreateFMul(s, float0_5);
-
-   t = builder.CreateFDiv(t, ma);
-   t = builder.CreateFAdd(t, float1);
-   t = builder.CreateFMul(t, float0_5);
+   Value * levelOffset = lod ? SelectLevel(builder, &sv, sampler, lod) : builder.getInt32(0);
 
+   // faces are sampled clamped to their edges, so linear filtering does not
+   // bleed in texels from the opposite edge of the same face at the seams
+   const unsigned wrap = 1; // GL_CLAMP_TO_EDGE
 //   ChannelType sType = Float, tType = Float;
    Value * xLerp = NULL, * yLerp = NULL;
-   Value * x = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapS,
-                            /*sType, */s, textureWidth, textureW, &xLerp);
-   Value * y = texcoordWrap(builder, gglCtx->textureState.textures[sampler].wrapT,
-                            /*tType, */t, textureHeight, textureH, &yLerp);
-   Value * indexOffset = builder.CreateMul(builder.CreateMul(textureHeight, textureWidth), face);
-   Value * index = builder.CreateAdd(builder.CreateMul(y, textureWidth), x);
-
-   Value * textureData = module->getGlobalVariable(_PF2_TEXTURE_DATA_NAME_);
-   if (!textureData)
-      textureData = new GlobalVariable(*module, intPointerType,
-                                       true, GlobalValue::ExternalLinkage,
-                                       NULL, _PF2_TEXTURE_DATA_NAME_);
-
-   textureData = builder.CreateConstInBoundsGEP1_32(textureData, sampler);
-   textureData = builder.CreateLoad(textureData);
-
-   if (0 == gglCtx->textureState.textures[sampler].minFilter &&
-         0 == gglCtx->textureState.textures[sampler].magFilter) { // GL_NEAREST
-      textureData = pointSample(builder, textureData, builder.CreateAdd(indexOffset, index),
-                                gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
-      return intColorVecToFloatColorVec(builder, textureData);
-
-   } else if (1 == gglCtx->textureState.textures[sampler].minFilter &&
-              1 == gglCtx->textureState.textures[sampler].magFilter) { // GL_LINEAR
-      textureData = linearSample(builder, textureData, indexOffset, x, y, xLerp, yLerp,
-                                 textureW, textureH,  textureWidth, textureHeight,
-                                 gglCtx->textureState.textures[sampler].format/*, dstDesc*/);
-      return intColorVecToFloatColorVec(builder, textureData);
+   Value * x = texcoordWrap(builder, wrap, /*sType, */s, sv.width, sv.widthMask, &xLerp);
+   Value * y = texcoordWrap(builder, wrap, /*tType, */t, sv.height, sv.heightMask, &yLerp);
+   Value * indexOffset = builder.CreateAdd(levelOffset, builder.CreateMul(sv.faceSize, face));
+
+   if (0 == texture.minFilter && 0 == texture.magFilter) { // GL_NEAREST
+      Value * index = builder.CreateAdd(indexOffset, texelIndex(builder, sv, x, y));
+      Value * ret = pointSample(builder, sv.data, index, texture.format/*, dstDesc*/);
+      return intColorVecToFloatColorVec(builder, ret);
+   } else if (1 == texture.minFilter && 1 == texture.magFilter) { // GL_LINEAR
+      Value * ret = linearSample(builder, sv, indexOffset, x, y, xLerp, yLerp,
+                                 wrap, wrap, texture.format/*, dstDesc*/);
+      return intColorVecToFloatColorVec(builder, ret);
    } else
       assert(!"unsupported texture filter");
    return NULL;
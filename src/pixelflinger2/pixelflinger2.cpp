@@ -165,7 +165,8 @@ static void EnableDisable(GGLInterface * iface, GLenum cap, GLboolean enable)
       ctx->state.bufferState.stencilTest = enable;
       break;
    case GL_DITHER:
-//      ALOGD("pf2: EnableDisable GL_DITHER \n");
+      changed |= ctx->state.bufferState.dither ^ enable;
+      ctx->state.bufferState.dither = enable;
       break;
    case GL_SCISSOR_TEST:
 //      ALOGD("pf2: EnableDisable GL_SCISSOR_TEST \n");
@@ -187,6 +188,7 @@ void InitializeGGLState(GGLInterface * iface)
 {
 #if USE_DUAL_THREAD
    reinterpret_cast<GGLContext *>(iface)->worker = GGLContext::Worker();
+   pthread_mutex_init(&reinterpret_cast<GGLContext *>(iface)->lazyClear.lock, NULL);
 #endif
    iface->DepthRangef = DepthRangef;
    iface->Viewport = Viewport;
@@ -202,6 +204,8 @@ void InitializeGGLState(GGLInterface * iface)
    InitializeScanLineFunctions(iface);
    InitializeShaderFunctions(iface);
    InitializeTextureFunctions(iface);
+   InitializeTileFunctions(iface);
+   InitializePresentFunctions(iface);
 
    iface->EnableDisable(iface, GL_DEPTH_TEST, false);
    iface->DepthFunc(iface, GL_LESS);
@@ -217,6 +221,7 @@ void InitializeGGLState(GGLInterface * iface)
    iface->EnableDisable(iface, GL_CULL_FACE, false);
 
    iface->EnableDisable(iface, GL_BLEND, false);
+   iface->EnableDisable(iface, GL_DITHER, false);
    iface->BlendColor(iface, 0, 0, 0, 0);
    iface->BlendEquationSeparate(iface, GL_FUNC_ADD, GL_FUNC_ADD);
    iface->BlendFuncSeparate(iface, GL_ONE, GL_ZERO, GL_ONE, GL_ZERO);
@@ -248,9 +253,12 @@ GGLInterface * CreateGGLInterface()
 
 void UninitializeGGLState(GGLInterface * iface)
 {
+   DestroyPresentFunctions(iface); // present thread uses the rest of the state
 #if USE_DUAL_THREAD
    reinterpret_cast<GGLContext *>(iface)->worker.~Worker();
+   pthread_mutex_destroy(&reinterpret_cast<GGLContext *>(iface)->lazyClear.lock);
 #endif
+   iface->SetMultisample(iface, false); // frees sample buffers
    DestroyShaderFunctions(iface);
 
 #if USE_LLVM_TEXTURE_SAMPLER
@@ -24,6 +24,8 @@
 #define USE_LLVM_EXECUTIONENGINE 0 // 1 to use llvm::Execution, 0 to use libBCC, requires modifying makefile
 #endif
 #define USE_DUAL_THREAD 1
+#define USE_PRESENT_THREAD 1 // 0 runs frames of SubmitFrame before it returns
+#define USE_TIERED_JIT 1 // 0 JITs every shader instance once with all passes
 
 #define debug_printf printf
 
@@ -71,12 +73,21 @@ class BCCContext;
 typedef int BlendComp_t;
 #endif
 
-#if USE_DUAL_THREAD
+#if USE_DUAL_THREAD || USE_PRESENT_THREAD || USE_TIERED_JIT
 #include <pthread.h>
 #endif
 
 typedef void (*ShaderFunction_t)(const void*,void*,const void*);
 
+#define GGL_CLEAR_TILE_SHIFT 5 // lazy clear tiles are 32x32 pixels
+#define GGL_CLEAR_TILES_PER_ROW (GGL_MAX_VIEWPORT_DIMS >> GGL_CLEAR_TILE_SHIFT)
+// RenderTiles tile size, color, depth and stencil of a tile take 36KB
+#define GGL_RENDER_TILE_SHIFT 6
+#define GGL_RENDER_TILE_SIZE (1 << GGL_RENDER_TILE_SHIFT)
+// invocations after which a quickly JIT'd shader instance is recompiled optimized
+#define GGL_HOT_VERTICES (1 << 14)
+#define GGL_HOT_PIXELS (1 << 20)
+
 #define GGL_GET_CONTEXT(context, interface) GGLContext * context = (GGLContext *)interface;
 #define GGL_GET_CONST_CONTEXT(context, interface) const GGLContext * context = \
     (const GGLContext *)interface; (void)context;
@@ -94,8 +105,63 @@ struct GGLContext {
       int depth; // assuming ieee 754 32 bit float and 32 bit 2's complement int; z_32
       unsigned color; // clear value; rgba_8888
       unsigned stencil; // s_8; repeated to clear 4 pixels at a time
+      unsigned depth24; // depth clamped to [0,1] and scaled to 24 bit unorm; sz_24
+      unsigned depth16; // same for 16 bit unorm; z_16, repeated to clear 2 pixels at a time
    } clearState;
 
+   // in lazy mode Clear only tags tiles, which are filled on first touch by ScanLine
+   // or by Finish; tag bits are 1 for color, 2 for depth and 4 for stencil
+   mutable struct {
+      bool enable;
+      unsigned pendingTiles; // number of tiles with any tag bit set
+      // clearState at time of Clear, replicated for the surface formats into 32 bits
+      unsigned color, depth, stencil;
+      unsigned char tags[GGL_CLEAR_TILES_PER_ROW * GGL_CLEAR_TILES_PER_ROW];
+#if USE_DUAL_THREAD
+      pthread_mutex_t lock; // worker and main thread may touch the same tile
+#endif
+   } lazyClear;
+
+   // 4x multisample buffers allocated for the set surfaces with 4 consecutive samples per
+   // pixel in the surface formats, so width is 4 times that of the surface; scanlines render
+   // to them and ResolveMultisample averages color samples into frameSurface
+   struct {
+      bool enable;
+      GGLSurface frameSurface, depthSurface, stencilSurface;
+   } multisample;
+
+   // RenderTiles redirects rendering to these tile buffers; surfaces are tile sized with
+   // data pointing into the buffers, and SZ_24 stencil shares the depth buffer;
+   // bits are GL buffer bits, loaded and dirty are per tile
+   mutable struct {
+      bool active; // inside RenderTiles draw
+      unsigned x, y, width, height; // current tile in screen
+      GLbitfield loaded, dirty, invalidated;
+      GGLSurface frameSurface, depthSurface, stencilSurface;
+      unsigned color[GGL_RENDER_TILE_SIZE * GGL_RENDER_TILE_SIZE];
+      unsigned depth[GGL_RENDER_TILE_SIZE * GGL_RENDER_TILE_SIZE];
+      unsigned char stencil[GGL_RENDER_TILE_SIZE * GGL_RENDER_TILE_SIZE];
+   } tile;
+
+   struct Frame {
+      GGLSurface surface; // data is NULL to keep the color buffer
+      void (* draw)(GGLInterface * iface, void * user);
+      void (* present)(GGLInterface * iface, const GGLSurface * surface, void * user);
+      void * user;
+   };
+   // frames queued by SubmitFrame in a ring; fences are frame numbers starting at 1,
+   // and frame fence is complete once completed >= fence
+   mutable struct {
+      Frame frames[GGL_MAX_PENDING_FRAMES];
+      unsigned submitted, completed;
+#if USE_PRESENT_THREAD
+      bool quit;
+      pthread_t thread;
+      pthread_mutex_t lock;
+      pthread_cond_t submitCond, completeCond;
+#endif
+   } present;
+
    gl_shader_program * CurrentProgram;
 
    mutable GGLActiveStencil activeStencil; // after primitive assembly, call StencilSelect
@@ -166,8 +232,7 @@ unsigned cullFace :
    } cullState;
 };
 
-#define _PF2_TEXTURE_DATA_NAME_ "gl_PF2TEXTURE_DATA" /* sampler data pointers used by LLVM */
-#define _PF2_TEXTURE_DIMENSIONS_NAME_ "gl_PF2TEXTURE_DIMENSIONS" /* sampler dimensions used by LLVM */
+#define _PF2_TEXTURE_SAMPLERS_NAME_ "gl_PF2TEXTURE_SAMPLERS" /* sampler descriptors used by LLVM */
 
 void gglError(unsigned error); // not implmented, just an assert
 
@@ -179,10 +244,63 @@ void InitializeBufferFunctions(GGLInterface * iface);
 void InitializeRasterFunctions(GGLInterface * iface);
 void InitializeScanLineFunctions(GGLInterface * iface);
 void InitializeTextureFunctions(GGLInterface * iface);
+void InitializeTileFunctions(GGLInterface * iface);
+void InitializePresentFunctions(GGLInterface * iface);
+void DestroyPresentFunctions(GGLInterface * iface); // runs queued frames and joins thread
+
+// fills tiles tagged by lazy Clear that the span on line y touches, implemented in buffer.cpp
+void ResolveLazyClear(const GGLContext * ctx, const unsigned y, const unsigned startX,
+                      const unsigned endX);
+// fills all tiles tagged by lazy Clear
+void ResolveLazyClear(const GGLContext * ctx);
+
+// loads tile buffers of written and overwritten bits not yet loaded, except for overwritten
+// ones that are replaced entirely, and marks them dirty; implemented in tile.cpp
+void PrepareTile(const GGLContext * ctx, GLbitfield written, GLbitfield overwritten);
+// buffer bits written by scanlines with the current state
+static inline GLbitfield ScanLineWrites(const GGLContext * ctx)
+{
+   return GL_COLOR_BUFFER_BIT | (ctx->state.bufferState.depthTest ? GL_DEPTH_BUFFER_BIT : 0) |
+          (ctx->state.bufferState.stencilTest ? GL_STENCIL_BUFFER_BIT : 0);
+}
+
+// scanline into the multisample buffers with a 4 bit sample mask per pixel from start to end,
+// NULL coverage means all samples are covered; implemented in scanline.cpp
+void ScanLineMultisample(const GGLInterface * iface, const VertexOutput * start,
+                         const VertexOutput * end, const unsigned char * coverage);
+
+// pixel format conversion, implemented in convert.cpp
+unsigned PixelFormatSize(const GGLPixelFormat format); // bytes per pixel
+// converts count pixels between color formats of gglGetPixelFormatTable through rgba_8888;
+// premultiply scales rgb by alpha; dst may be src if both formats have the same size
+void ConvertPixels(void * dst, const GGLPixelFormat dstFormat, const void * src,
+                   const GGLPixelFormat srcFormat, const unsigned count, const bool premultiply);
+// averages 2x2 blocks from rgba_8888 rows a and b, each 2 * count pixels wide
+void BoxFilterRGBA(unsigned * dst, const unsigned * a, const unsigned * b, unsigned count);
+// averages groups of 4 consecutive rgba_8888 samples into count pixels, dst may be samples;
+// channel order does not matter so BGRA_8888 and RGBX_8888 work too
+void ResolveSamplesRGBA(unsigned * dst, const unsigned * samples, unsigned count);
+// interpolates count pixels of rgba_8888 rows a and b by weight / 256 of b, weight is [0,255]
+void LerpRGBA(unsigned * dst, const unsigned * a, const unsigned * b, const unsigned weight,
+              unsigned count);
+// resamples an rgba_8888 row with nearest or linear filtering
+void ResampleRGBA(unsigned * dst, const unsigned dstWidth, const unsigned * src,
+                  const unsigned srcWidth, const bool linear);
+
+// texel offset of level of face (cube map +x,-x,+y,-y,+z,-z) in GGLTexture::levels
+unsigned TextureLevelOffset(const GGLTexture * texture, const unsigned level, const unsigned face);
+// whether sampler can use shift and mask addressing, part of ShaderKey
+static inline bool TexturePowerOf2(const GGLTexture * texture)
+{
+   return texture->width && texture->height && !(texture->width & (texture->width - 1)) &&
+          !(texture->height & (texture->height - 1));
+}
 
 void InitializeShaderFunctions(GGLInterface * iface); // set function pointers and create needed objects
 void SetShaderVerifyFunctions(GGLInterface * iface); // called by state change functions
 void DestroyShaderFunctions(GGLInterface * iface); // destroy needed objects
+// counts invocations of the active instance of shader, which is recompiled optimized once hot
+void CountShaderInvocations(gl_shader * shader, const unsigned count);
 // actual gl_shader and gl_shader_program is created and destroyed by Shader(Program)Create/Delete,
 
 #endif // #ifndef _PIXELFLINGER2_H_
@@ -0,0 +1,151 @@
+/**
+ **
+ ** Copyright 2010, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include "src/pixelflinger2/pixelflinger2.h"
+
+static void RunFrame(GGLContext * ctx, const GGLContext::Frame & frame)
+{
+   GGLInterface * const iface = &ctx->interface;
+   if (frame.surface.data) {
+      GGLSurface surface = frame.surface;
+      iface->SetBuffer(iface, GL_COLOR_BUFFER_BIT, &surface);
+   }
+   frame.draw(iface, frame.user);
+   iface->Finish(iface);
+   if (frame.present)
+      frame.present(iface, &ctx->frameSurface, frame.user);
+}
+
+#if USE_PRESENT_THREAD
+static void * PresentThread(void * threadArgs)
+{
+   GGLContext * const ctx = (GGLContext *)threadArgs;
+   pthread_mutex_lock(&ctx->present.lock);
+   while (true) {
+      while (!ctx->present.quit && ctx->present.completed == ctx->present.submitted)
+         pthread_cond_wait(&ctx->present.submitCond, &ctx->present.lock);
+      if (ctx->present.completed == ctx->present.submitted)
+         break; // quit once queued frames are done
+      const GGLContext::Frame frame = ctx->present.frames[ctx->present.completed %
+                                      GGL_MAX_PENDING_FRAMES];
+      pthread_mutex_unlock(&ctx->present.lock);
+
+      RunFrame(ctx, frame);
+
+      pthread_mutex_lock(&ctx->present.lock);
+      ctx->present.completed++;
+      pthread_cond_broadcast(&ctx->present.completeCond);
+   }
+   pthread_mutex_unlock(&ctx->present.lock);
+   return NULL;
+}
+#endif
+
+static unsigned SubmitFrame(GGLInterface * iface, const GGLSurface * surface,
+                            void (* draw)(GGLInterface * iface, void * user),
+                            void (* present)(GGLInterface * iface, const GGLSurface * surface,
+                                             void * user), void * user)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   if (!draw) {
+      gglError(GL_INVALID_VALUE);
+      return 0;
+   }
+   GGLContext::Frame frame;
+   memset(&frame, 0, sizeof(frame));
+   if (surface)
+      frame.surface = *surface;
+   frame.draw = draw;
+   frame.present = present;
+   frame.user = user;
+
+#if USE_PRESENT_THREAD
+   pthread_mutex_lock(&ctx->present.lock);
+   if (!ctx->present.thread) {
+      pthread_attr_t attr;
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+      int rc = pthread_create(&ctx->present.thread, &attr, PresentThread, ctx);
+      pthread_attr_destroy(&attr);
+      if (rc) {
+         ALOGD("pf2: SubmitFrame pthread_create failed %d, running frames synchronously", rc);
+         ctx->present.thread = 0;
+         pthread_mutex_unlock(&ctx->present.lock);
+         RunFrame(ctx, frame);
+         pthread_mutex_lock(&ctx->present.lock);
+         const unsigned fence = ctx->present.completed = ++ctx->present.submitted;
+         pthread_mutex_unlock(&ctx->present.lock);
+         return fence;
+      }
+   }
+   while (ctx->present.submitted - ctx->present.completed >= GGL_MAX_PENDING_FRAMES)
+      pthread_cond_wait(&ctx->present.completeCond, &ctx->present.lock);
+   ctx->present.frames[ctx->present.submitted % GGL_MAX_PENDING_FRAMES] = frame;
+   const unsigned fence = ++ctx->present.submitted;
+   pthread_cond_signal(&ctx->present.submitCond);
+   pthread_mutex_unlock(&ctx->present.lock);
+   return fence;
+#else
+   RunFrame(ctx, frame);
+   return ctx->present.completed = ++ctx->present.submitted;
+#endif
+}
+
+static void WaitFence(const GGLInterface * iface, unsigned fence)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+#if USE_PRESENT_THREAD
+   pthread_mutex_lock(&ctx->present.lock);
+   if (!fence)
+      fence = ctx->present.submitted;
+   while (ctx->present.completed < fence)
+      pthread_cond_wait(&ctx->present.completeCond, &ctx->present.lock);
+   pthread_mutex_unlock(&ctx->present.lock);
+#else
+   assert(ctx->present.completed >= fence);
+#endif
+}
+
+void InitializePresentFunctions(GGLInterface * iface)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+#if USE_PRESENT_THREAD
+   pthread_mutex_init(&ctx->present.lock, NULL);
+   pthread_cond_init(&ctx->present.submitCond, NULL);
+   pthread_cond_init(&ctx->present.completeCond, NULL);
+#endif
+   iface->SubmitFrame = SubmitFrame;
+   iface->WaitFence = WaitFence;
+}
+
+void DestroyPresentFunctions(GGLInterface * iface)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+#if USE_PRESENT_THREAD
+   if (ctx->present.thread) {
+      pthread_mutex_lock(&ctx->present.lock);
+      ctx->present.quit = true;
+      pthread_cond_signal(&ctx->present.submitCond);
+      pthread_mutex_unlock(&ctx->present.lock);
+      pthread_join(ctx->present.thread, NULL);
+      ctx->present.thread = 0;
+   }
+   pthread_cond_destroy(&ctx->present.completeCond);
+   pthread_cond_destroy(&ctx->present.submitCond);
+   pthread_mutex_destroy(&ctx->present.lock);
+#endif
+}
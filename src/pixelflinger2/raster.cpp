@@ -57,8 +57,10 @@ static inline void InterpolateVertex(const VertexOutput * a, const VertexOutput
 void GGLProcessVertex(const gl_shader_program * program, const VertexInput * input,
                       VertexOutput * output, const float (*constants)[4])
 {
-   ShaderFunction_t function = (ShaderFunction_t)program->_LinkedShaders[MESA_SHADER_VERTEX]->function;
+   gl_shader * shader = program->_LinkedShaders[MESA_SHADER_VERTEX];
+   ShaderFunction_t function = (ShaderFunction_t)shader->function;
    function(input, output, constants);
+   CountShaderInvocations(shader, 1);
 }
 
 static void ProcessVertex(const GGLInterface * iface, const VertexInput * input,
@@ -86,11 +88,82 @@ static void ProcessVertex(const GGLInterface * iface, const VertexInput * input,
 //#endif
 }
 
+// 4x multisample span of row bV to cV; bSlope and cSlope are the edge x steps per row;
+// samples are an ordered 2x2 grid at x + 0.25 and x + 0.75, on y - 0.25 for samples 0 and 1
+// and y + 0.25 for samples 2 and 3, covered if in [left, right) of the edges on their row
+static void RasterSpanMultisample(const GGLInterface * iface, const VertexOutput * bV,
+                                  const VertexOutput * cV, const float bSlope,
+                                  const float cSlope, const unsigned width,
+                                  const unsigned varyingCount)
+{
+   const float left[2] = {bV->position.x - 0.25f * bSlope, bV->position.x + 0.25f * bSlope};
+   const float right[2] = {cV->position.x - 0.25f * cSlope, cV->position.x + 0.25f * cSlope};
+   int startX = floorf(MIN2(left[0], left[1])), endX = floorf(MAX2(right[0], right[1]));
+   startX = MAX2(startX, 0);
+   endX = MIN2(endX, (int)MIN2(width, GGL_MAX_VIEWPORT_DIMS) - 1);
+
+   unsigned char coverage[GGL_MAX_VIEWPORT_DIMS];
+   for (int x = startX; x <= endX; x++) {
+      unsigned char mask = 0;
+      for (unsigned i = 0; i < 4; i++) {
+         const float sampleX = x + 0.25f + 0.5f * (i & 1);
+         mask |= (left[i >> 1] <= sampleX && sampleX < right[i >> 1]) << i;
+      }
+      coverage[x] = mask;
+   }
+   while (startX <= endX && !coverage[startX])
+      startX++;
+   while (endX >= startX && !coverage[endX])
+      endX--;
+   if (startX > endX)
+      return;
+
+   VertexOutput start, end;
+   const float dx = cV->position.x - bV->position.x;
+   InterpolateVertex(bV, cV, dx > 0 ? (startX - bV->position.x) / dx : 0, &start, varyingCount);
+   InterpolateVertex(bV, cV, dx > 0 ? (endX - bV->position.x) / dx : 0, &end, varyingCount);
+   // exact, since GGLScanLine truncates x and the coverage is per pixel from startX to endX
+   start.position.x = startX;
+   end.position.x = endX;
+   ScanLineMultisample(iface, &start, &end, coverage + startX);
+}
+
+// horizontally clips row bV to cV to the surface, or the tile of RenderTiles, and scans it
+static void RasterSpan(const GGLInterface * iface, const VertexOutput * bV,
+                       const VertexOutput * cV, const float bSlope, const float cSlope,
+                       const unsigned width, const unsigned varyingCount)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   if (ctx->multisample.enable)
+      return RasterSpanMultisample(iface, bV, cV, bSlope, cSlope, width, varyingCount);
+
+   const int minX = ctx->tile.active ? ctx->tile.x : 0;
+   const int maxX = ctx->tile.active ? ctx->tile.x + ctx->tile.width : width;
+   VertexOutput clip0, clip1;
+   const VertexOutput * left, * right;
+   if (bV->position.x < minX) {
+      if (cV->position.x < minX)
+         return;
+      InterpolateVertex(bV, cV, (minX - bV->position.x) / (cV->position.x - bV->position.x),
+                        &clip0, varyingCount);
+      left = &clip0;
+   } else
+      left = bV;
+   if ((int)cV->position.x >= maxX) {
+      if (bV->position.x >= maxX)
+         return;
+      InterpolateVertex(bV, cV, (maxX - 1 - bV->position.x) / (cV->position.x - bV->position.x),
+                        &clip1, varyingCount);
+      right = &clip1;
+   } else
+      right = cV;
+   iface->ScanLine(iface, left, right);
+}
+
 #if USE_DUAL_THREAD
 static void * RasterTrapezoidWorker(void * threadArgs)
 {
    GGLContext::Worker * args = (GGLContext::Worker *)threadArgs;
-   VertexOutput clip0, clip1, * left, * right;
 
    pthread_mutex_lock(&args->finishLock);
    pthread_mutex_lock(&args->assignLock);
@@ -108,27 +181,9 @@ static void * RasterTrapezoidWorker(void * threadArgs)
           assert(args->assignedWork);
 
       for (unsigned y = args->startY; y <= args->endY; y += 2) {
-         do {
-            if (args->bV.position.x < 0) {
-               if (args->cV.position.x < 0)
-                  break;
-               InterpolateVertex(&args->bV, &args->cV, -args->bV.position.x /
-                                 (args->cV.position.x - args->bV.position.x),
-                                 &clip0, args->varyingCount);
-               left = &clip0;
-            } else
-               left = &args->bV;
-            if ((int)args->cV.position.x >= (int)args->width) {
-               if (args->bV.position.x >= (int)args->width)
-                  break;
-               InterpolateVertex(&args->bV, &args->cV, (args->width - 1 - args->bV.position.x) /
-                                 (args->cV.position.x - args->bV.position.x),
-                                 &clip1, args->varyingCount);
-               right = &clip1;
-            } else
-               right = &args->cV;
-            args->iface->ScanLine(args->iface, left, right);
-         } while (false);
+         // bDx and cDx step 2 rows
+         RasterSpan(args->iface, &args->bV, &args->cV, args->bDx.position.x * 0.5f,
+                    args->cDx.position.x * 0.5f, args->width, args->varyingCount);
          for (unsigned i = 0; i < args->varyingCount; i++) {
             args->bV.varyings[i] += args->bDx.varyings[i];
             args->cV.varyings[i] += args->cDx.varyings[i];
@@ -160,7 +215,9 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
 
    const unsigned width = ctx->frameSurface.width, height = ctx->frameSurface.height;
    const unsigned varyingCount = ctx->CurrentProgram->VaryingSlots;
-
+   // RenderTiles only rasterizes the rows of the current tile
+   const int minY = ctx->tile.active ? ctx->tile.y : 0;
+   const int maxY = ctx->tile.active ? ctx->tile.y + ctx->tile.height : height;
 
    // tlv-trv and blv-brv are parallel and horizontal
    VertexOutput tlv(*tl), trv(*tr), blv(*bl), brv(*br);
@@ -168,23 +225,23 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
 
    // vertically clip
 
-   if ((int)tlv.position.y < 0) {
-      InterpolateVertex(&tlv, &blv, (0 - tlv.position.y) / (blv.position.y - tlv.position.y),
+   if ((int)tlv.position.y < minY) {
+      InterpolateVertex(&tlv, &blv, (minY - tlv.position.y) / (blv.position.y - tlv.position.y),
                         &tmp, varyingCount);
       tlv = tmp;
    }
-   if ((int)trv.position.y < 0) {
-      InterpolateVertex(&trv, &brv, (0 - trv.position.y) / (brv.position.y - trv.position.y),
+   if ((int)trv.position.y < minY) {
+      InterpolateVertex(&trv, &brv, (minY - trv.position.y) / (brv.position.y - trv.position.y),
                         &tmp, varyingCount);
       trv = tmp;
    }
-   if ((int)blv.position.y >= (int)height) {
-      InterpolateVertex(&tlv, &blv, (height - 1 - tlv.position.y) / (blv.position.y - tlv.position.y),
+   if ((int)blv.position.y >= maxY) {
+      InterpolateVertex(&tlv, &blv, (maxY - 1 - tlv.position.y) / (blv.position.y - tlv.position.y),
                         &tmp, varyingCount);
       blv = tmp;
    }
-   if ((int)brv.position.y >= (int)height) {
-      InterpolateVertex(&trv, &brv, (height - 1 - trv.position.y) / (brv.position.y - trv.position.y),
+   if ((int)brv.position.y >= maxY) {
+      InterpolateVertex(&trv, &brv, (maxY - 1 - trv.position.y) / (brv.position.y - trv.position.y),
                         &tmp, varyingCount);
       brv = tmp;
    }
@@ -216,6 +273,8 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
 
    if (endY < startY)
       return;
+   if (ctx->tile.active) // load tile buffers before the worker thread scans into them
+      PrepareTile(ctx, ScanLineWrites(ctx), 0);
 
    const VectorComp_t yDistInv = VectorComp_t_CTR(1.0f / (endY - startY));
 
@@ -246,6 +305,9 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
    cDx.frontFacingPointCoord *= yDistInv;
    cDx.frontFacingPointCoord.y = VectorComp_t_Zero; // gl_FrontFacing not interpolated
 
+   // edge x steps per row, before bDx and cDx are doubled for the worker
+   const float bSlope = bDx.position.x, cSlope = cDx.position.x;
+
 #if USE_DUAL_THREAD
    GGLContext::Worker & args = ctx->worker;
    if (!ctx->worker.thread) {
@@ -291,29 +353,8 @@ static void RasterTrapezoid(const GGLInterface * iface, const VertexOutput * tl,
    }
 #endif
 
-   VertexOutput * left, * right;
-   VertexOutput clip0, clip1;
-
    for (unsigned y = startY; y <= endY; y += 1 + USE_DUAL_THREAD) {
-      do {
-         if (bV.position.x < 0) {
-            if (cV.position.x < 0)
-               break;
-            InterpolateVertex(&bV, &cV, -bV.position.x / (cV.position.x - bV.position.x),
-                              &clip0, varyingCount);
-            left = &clip0;
-         } else
-            left = &bV;
-         if ((int)cV.position.x >= (int)width) {
-            if (bV.position.x >= (int)width)
-               break;
-            InterpolateVertex(&bV, &cV, (width - 1 - bV.position.x) / (cV.position.x - bV.position.x),
-                              &clip1, varyingCount);
-            right = &clip1;
-         } else
-            right = &cV;
-         iface->ScanLine(iface, left, right);
-      } while (false);
+      RasterSpan(iface, &bV, &cV, bSlope, cSlope, width, varyingCount);
       for (unsigned i = 0; i < varyingCount; i++) {
          bV.varyings[i] += bDx.varyings[i];
          cV.varyings[i] += cDx.varyings[i];
@@ -180,13 +180,19 @@ unsigned char StencilOp(const unsigned op, unsigned char s, const unsigned char
 typedef void (* ScanLineFunction_t)(VertexOutput * start, VertexOutput * step,
                                     const float (*constants)[4], void * frame,
                                     int * depth, unsigned char * stencil,
-                                    GGLActiveStencil *, unsigned count);
+                                    GGLActiveStencil *, unsigned count,
+                                    const unsigned char * coverage);
 #endif
 
-void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFormat,
-                 void * frameBuffer, int * depthBuffer, unsigned char * stencilBuffer,
-                 unsigned bufferWidth, unsigned bufferHeight, GGLActiveStencil * activeStencil,
-                 const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4])
+// GGLScanLine for buffers with top left pixel at bufferX, bufferY of screen
+static void ScanLineBuffers(const gl_shader_program * program, const GGLPixelFormat colorFormat,
+                            void * frameBuffer, const GGLPixelFormat depthFormat, void * depthBuffer,
+                            const GGLPixelFormat stencilFormat, void * stencilBuffer,
+                            const unsigned bufferX, const unsigned bufferY,
+                            unsigned bufferWidth, unsigned bufferHeight,
+                            GGLActiveStencil * activeStencil, const VertexOutput_t * start,
+                            const VertexOutput_t * end, const float (*constants)[4],
+                            const unsigned char * coverage)
 {
 #if !USE_LLVM_SCANLINE
    assert(!"only for USE_LLVM_SCANLINE");
@@ -199,14 +205,17 @@ void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFo
    const unsigned y = start->position.y, startX = start->position.x,
                       endX = end->position.x;
 
-   assert(bufferWidth > startX && bufferWidth > endX);
-   assert(bufferHeight > y);
+   assert(bufferX <= startX && bufferWidth > startX - bufferX && bufferWidth > endX - bufferX);
+   assert(bufferY <= y && bufferHeight > y - bufferY);
 
+   // multisample buffers have 4 consecutive samples per pixel
+   const unsigned offset = ((y - bufferY) * bufferWidth + startX - bufferX) * (coverage ? 4 : 1);
    char * frame = (char *)frameBuffer;
-   if (GGL_PIXEL_FORMAT_RGBA_8888 == colorFormat)
-      frame += (y * bufferWidth + startX) * 4;
+   if (GGL_PIXEL_FORMAT_RGBA_8888 == colorFormat || GGL_PIXEL_FORMAT_BGRA_8888 == colorFormat ||
+         GGL_PIXEL_FORMAT_RGBX_8888 == colorFormat)
+      frame += offset * 4;
    else if (GGL_PIXEL_FORMAT_RGB_565 == colorFormat)
-      frame += (y * bufferWidth + startX) * 2;
+      frame += offset * 2;
    else 
       assert(0);
    const VectorComp_t div = VectorComp_t_CTR(1 / (float)(endX - startX));
@@ -228,28 +237,78 @@ void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFo
    vertexDx.frontFacingPointCoord *= div; // gl_PointCoord, only zw
    vertexDx.frontFacingPointCoord.y = 0; // gl_FrontFacing not interpolated
 
-   int * depth = depthBuffer + y * bufferWidth + startX;
-   unsigned char * stencil = stencilBuffer + y * bufferWidth + startX;
+   // formats not set yet have size 0, and the jit does not access those buffers
+   int * depth = (int *)((char *)depthBuffer + offset * PixelFormatSize(depthFormat));
+   unsigned char * stencil = (unsigned char *)stencilBuffer + offset * PixelFormatSize(stencilFormat);
 
    // TODO DXL consider inverting gl_FragCoord.y
-   ScanLineFunction_t scanLineFunction = (ScanLineFunction_t)
-                                         program->_LinkedShaders[MESA_SHADER_FRAGMENT]->function;
+   gl_shader * shader = program->_LinkedShaders[MESA_SHADER_FRAGMENT];
+   ScanLineFunction_t scanLineFunction = (ScanLineFunction_t)shader->function;
 //   ALOGD("pf2 GGLScanLine scanline=%p start=%p constants=%p", scanLineFunction, &vertex, constants);
-   if (endX >= startX)
-      scanLineFunction(&vertex, &vertexDx, constants, frame, depth, stencil, activeStencil, endX - startX + 1);
+   if (endX >= startX) {
+      scanLineFunction(&vertex, &vertexDx, constants, frame, depth, stencil, activeStencil,
+                       endX - startX + 1, coverage);
+      CountShaderInvocations(shader, endX - startX + 1);
+   }
 
 //   ALOGD("pf2: GGLScanLine end");
 
 }
 
+void GGLScanLine(const gl_shader_program * program, const GGLPixelFormat colorFormat,
+                 void * frameBuffer, const GGLPixelFormat depthFormat, void * depthBuffer,
+                 const GGLPixelFormat stencilFormat, void * stencilBuffer,
+                 unsigned bufferWidth, unsigned bufferHeight, GGLActiveStencil * activeStencil,
+                 const VertexOutput_t * start, const VertexOutput_t * end, const float (*constants)[4],
+                 const unsigned char * coverage)
+{
+   ScanLineBuffers(program, colorFormat, frameBuffer, depthFormat, depthBuffer, stencilFormat,
+                   stencilBuffer, 0, 0, bufferWidth, bufferHeight, activeStencil, start, end,
+                   constants, coverage);
+}
+
+void ScanLineMultisample(const GGLInterface * iface, const VertexOutput * start,
+                         const VertexOutput * end, const unsigned char * coverage)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   unsigned char covered[GGL_MAX_VIEWPORT_DIMS];
+   if (!coverage) { // span from ScanLine covers all samples
+      const int count = (int)end->position.x - (int)start->position.x + 1;
+      if (count <= 0)
+         return;
+      memset(covered, 0xf, count);
+      coverage = covered;
+   }
+   GGLScanLine(ctx->CurrentProgram, ctx->multisample.frameSurface.format,
+               ctx->multisample.frameSurface.data, ctx->multisample.depthSurface.format,
+               ctx->multisample.depthSurface.data, ctx->multisample.stencilSurface.format,
+               ctx->multisample.stencilSurface.data, ctx->frameSurface.width,
+               ctx->frameSurface.height, &ctx->activeStencil, start, end,
+               ctx->CurrentProgram->ValuesUniform, coverage);
+}
+
 template <bool StencilTest, bool DepthTest, bool DepthWrite, bool BlendEnable>
 void ScanLine(const GGLInterface * iface, const VertexOutput * start, const VertexOutput * end)
 {
    GGL_GET_CONST_CONTEXT(ctx, iface);
+   if (ctx->multisample.enable)
+      return ScanLineMultisample(iface, start, end, NULL);
+   if (ctx->tile.active) {
+      PrepareTile(ctx, ScanLineWrites(ctx), 0);
+      return ScanLineBuffers(ctx->CurrentProgram, ctx->tile.frameSurface.format,
+                             ctx->tile.frameSurface.data, ctx->tile.depthSurface.format,
+                             ctx->tile.depthSurface.data, ctx->tile.stencilSurface.format,
+                             ctx->tile.stencilSurface.data, ctx->tile.x, ctx->tile.y,
+                             ctx->tile.width, ctx->tile.height, &ctx->activeStencil,
+                             start, end, ctx->CurrentProgram->ValuesUniform, NULL);
+   }
+   if (ctx->lazyClear.pendingTiles)
+      ResolveLazyClear(ctx, start->position.y, start->position.x, end->position.x);
    GGLScanLine(ctx->CurrentProgram, ctx->frameSurface.format, ctx->frameSurface.data,
-               (int *)ctx->depthSurface.data, (unsigned char *)ctx->stencilSurface.data,
+               ctx->depthSurface.format, ctx->depthSurface.data,
+               ctx->stencilSurface.format, ctx->stencilSurface.data,
                ctx->frameSurface.width, ctx->frameSurface.height, &ctx->activeStencil,
-               start, end, ctx->CurrentProgram->ValuesUniform);
+               start, end, ctx->CurrentProgram->ValuesUniform, NULL);
 //   GGL_GET_CONST_CONTEXT(ctx, iface);
 //   //    assert((unsigned)start->position.y == (unsigned)end->position.y);
 //   //
@@ -18,12 +18,22 @@
 #include <assert.h>
 #include <stdio.h>
 #include <string.h>
+#include <deque>
 #include <map>
 
 #include <llvm/LLVMContext.h>
 #include <llvm/Module.h>
+#include <llvm/PassManager.h>
+#include <llvm/Analysis/Passes.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/Threading.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/Transforms/Vectorize.h>
 #include <llvm/Support/raw_ostream.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <bcc/BCCContext.h>
 #include <bcc/Compiler.h>
@@ -68,9 +78,9 @@ static void InitializeGLContext(struct gl_context *ctx)
    ctx->Const.VertexProgram.MaxAttribs = 16;
    ctx->Const.VertexProgram.MaxUniformComponents = 512;
    ctx->Const.MaxVarying = 8;
-   ctx->Const.MaxVertexTextureImageUnits = 0;
-   ctx->Const.MaxCombinedTextureImageUnits = 2;
-   ctx->Const.MaxTextureImageUnits = 2;
+   ctx->Const.MaxVertexTextureImageUnits = GGL_MAXVERTEXTEXTUREIMAGEUNITS;
+   ctx->Const.MaxCombinedTextureImageUnits = GGL_MAXCOMBINEDTEXTUREIMAGEUNITS;
+   ctx->Const.MaxTextureImageUnits = GGL_MAXTEXTUREIMAGEUNITS;
    ctx->Const.FragmentProgram.MaxUniformComponents = 64;
 
    ctx->Const.MaxDrawBuffers = 2;
@@ -109,7 +119,8 @@ struct ShaderKey {
       GGLBlendState blendState;
    } scanLineKey;
    GGLPixelFormat textureFormats[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS];
-   unsigned char textureParameters[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS]; // wrap and filter
+   unsigned short textureParameters[GGL_MAXCOMBINEDTEXTUREIMAGEUNITS]; // wrap, filter and pot
+   unsigned passes; // gl_shader_program::Passes, not part of the key string
    bool operator <(const ShaderKey & rhs) const {
       return memcmp(this, &rhs, sizeof(*this)) < 0;
    }
@@ -120,9 +131,23 @@ struct Instance {
    llvm::SmallVector<char, 1024> resultObj;
    bcc::ObjectLoader * exec;
    void (* function)();
+#if USE_TIERED_JIT
+   // the quick JIT keeps what is needed to recompile optimized once the countdown runs out
+   llvm::SmallVector<char, 1024> bitcode; // module before OptimizeModule
+   const char * functionName;
+   gl_shader * shader;
+   gl_shader_program * program;
+   const GGLState * gglState; // live state, for the texture samplers symbol
+   unsigned passes, countdown;
+   bool hot; // queued or recompiled
+   Instance * optimized; // kept alive with the quick code, scanlines may still be running it
+#endif
    ~Instance() {
       delete script;
       delete exec;
+#if USE_TIERED_JIT
+      delete optimized;
+#endif
    }
 };
 
@@ -130,6 +155,51 @@ struct Executable { // codegen info
    std::map<ShaderKey, Instance *> instances;
 };
 
+#if USE_TIERED_JIT
+// hot instances are recompiled on a thread with its own BCCContext, since LLVMContext
+// is not thread safe, and the result is swapped into gl_shader::function
+static struct TieredJIT {
+   pthread_mutex_t lock;
+   pthread_cond_t queueCond, doneCond;
+   pthread_t thread;
+   std::deque<Instance *> queue;
+   Instance * compiling;
+   bool quit;
+   TieredJIT() : thread(0), compiling(NULL), quit(false) {
+      pthread_mutex_init(&lock, NULL);
+      pthread_cond_init(&queueCond, NULL);
+      pthread_cond_init(&doneCond, NULL);
+   }
+   ~TieredJIT() {
+      if (thread) {
+         pthread_mutex_lock(&lock);
+         quit = true;
+         pthread_cond_signal(&queueCond);
+         pthread_mutex_unlock(&lock);
+         pthread_join(thread, NULL);
+      }
+      pthread_cond_destroy(&doneCond);
+      pthread_cond_destroy(&queueCond);
+      pthread_mutex_destroy(&lock);
+   }
+} tieredJIT;
+
+// drops queued instances of shader or of gglState, and waits if one is being recompiled
+static void CancelHotInstances(const gl_shader * shader, const GGLState * gglState)
+{
+   pthread_mutex_lock(&tieredJIT.lock);
+   for (std::deque<Instance *>::iterator it = tieredJIT.queue.begin(); it != tieredJIT.queue.end(); )
+      if ((*it)->shader == shader || (*it)->gglState == gglState)
+         it = tieredJIT.queue.erase(it);
+      else
+         it++;
+   while (tieredJIT.compiling && (tieredJIT.compiling->shader == shader ||
+                                  tieredJIT.compiling->gglState == gglState))
+      pthread_cond_wait(&tieredJIT.doneCond, &tieredJIT.lock);
+   pthread_mutex_unlock(&tieredJIT.lock);
+}
+#endif
+
 bool do_mat_op_to_vec(exec_list *instructions);
 
 extern void link_shaders(const struct gl_context *ctx, struct gl_shader_program *prog);
@@ -194,6 +264,10 @@ static GLboolean ShaderCompile(const GGLInterface * iface, gl_shader * shader,
 
 void GGLShaderDelete(gl_shader * shader)
 {
+#if USE_TIERED_JIT
+   if (shader && shader->executable)
+      CancelHotInstances(shader, NULL);
+#endif
    if (shader && shader->executable) {
       for (std::map<ShaderKey, Instance *>::iterator it=shader->executable->instances.begin();
             it != shader->executable->instances.end(); it++)
@@ -223,6 +297,8 @@ gl_shader_program * GGLShaderProgramCreate()
       hieralloc_free(program);
       return NULL;
    }
+   program->Passes = GGL_SHADER_PASSES_DEFAULT;
+   GGLShaderProgramDump(program, getenv("PF2_SHADER_DUMP"));
    return program;
 }
 
@@ -263,6 +339,12 @@ static void ShaderAttach(const GGLInterface * iface, gl_shader_program * program
 
 GLboolean GGLShaderProgramLink(gl_shader_program * program, const char ** infoLog)
 {
+   // link_shaders would free the old linked shaders without destroying their instances,
+   // leaving hot ones queued on the tiered JIT thread
+   for (unsigned i = 0; i < MESA_SHADER_TYPES; i++) {
+      GGLShaderDelete(program->_LinkedShaders[i]);
+      program->_LinkedShaders[i] = NULL;
+   }
    link_shaders(glContext.ctx, program);
    if (infoLog)
       *infoLog = program->InfoLog;
@@ -284,6 +366,18 @@ GLboolean GGLShaderProgramLink(gl_shader_program * program, const char ** infoLo
    return program->LinkStatus;
 }
 
+void GGLShaderProgramPasses(gl_shader_program * program, GLbitfield passes)
+{
+   // instances are keyed by passes, so ones JIT'd with other passes are kept
+   program->Passes = passes & GGL_SHADER_PASSES_ALL;
+}
+
+void GGLShaderProgramDump(gl_shader_program * program, const char * directory)
+{
+   // earlier strings are freed with program, the tiered JIT thread may still be dumping to one
+   program->DumpDirectory = directory ? hieralloc_strdup(program, directory) : NULL;
+}
+
 static GLboolean ShaderProgramLink(gl_shader_program * program, const char ** infoLog)
 {
    return GGLShaderProgramLink(program, infoLog);
@@ -311,6 +405,7 @@ static void GetShaderKey(const GGLState * ctx, const gl_shader * shader, ShaderK
          key->textureParameters[i] |= texture.minFilter << (2 + 2);
          assert((1 << 1) > texture.magFilter);
          key->textureParameters[i] |= texture.magFilter << (2 + 2 + 3);
+         key->textureParameters[i] |= TexturePowerOf2(&texture) << (2 + 2 + 3 + 1);
       }
 }
 
@@ -319,7 +414,7 @@ static inline char HexDigit(unsigned char d)
    return (d > 9 ? d + 'A' - 10 : d + '0');
 }
 
-static const unsigned SHADER_KEY_STRING_LEN = GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 4 + 2;
+static const unsigned SHADER_KEY_STRING_LEN = GGL_MAXCOMBINEDTEXTUREIMAGEUNITS * 6 + 2;
 
 static void GetShaderKeyString(const GLenum type, const ShaderKey * key,
                                char * buffer, const unsigned bufferSize)
@@ -337,8 +432,10 @@ static void GetShaderKeyString(const GLenum type, const ShaderKey * key,
    for (unsigned i = 0; i < GGL_MAXCOMBINEDTEXTUREIMAGEUNITS; i++) {
       *str++ = HexDigit(key->textureFormats[i] / 16);
       *str++ = HexDigit(key->textureFormats[i] % 16);
-      *str++ = HexDigit(key->textureParameters[i] / 16);
-      *str++ = HexDigit(key->textureParameters[i] % 16);
+      *str++ = HexDigit(key->textureParameters[i] >> 12);
+      *str++ = HexDigit((key->textureParameters[i] >> 8) & 0xf);
+      *str++ = HexDigit((key->textureParameters[i] >> 4) & 0xf);
+      *str++ = HexDigit(key->textureParameters[i] & 0xf);
    }
    *str++ = '\0';
 }
@@ -375,10 +472,8 @@ static void* SymbolLookup(void* pContext, const char* name)
    const GGLState * gglCtx = ctx->gglCtx;
    const void * symbol = (void*)dlsym(RTLD_DEFAULT, name);
    if (NULL == symbol) {
-      if (!strcmp(_PF2_TEXTURE_DATA_NAME_, name))
-         symbol = (void *)gglCtx->textureState.textureData;
-      else if (!strcmp(_PF2_TEXTURE_DIMENSIONS_NAME_, name))
-         symbol = (void *)gglCtx->textureState.textureDimensions;
+      if (!strcmp(_PF2_TEXTURE_SAMPLERS_NAME_, name))
+         symbol = (void *)gglCtx->textureState.samplers;
       else // attributes, varyings and uniforms are mapped to locations in pointers
       {
          ALOGD("pf2: SymbolLookup unknown symbol: '%s'", name);
@@ -390,8 +485,87 @@ static void* SymbolLookup(void* pContext, const char* name)
    return (void *)symbol;
 }
 
+// runs the selected function passes on every function in module
+static void OptimizeModule(llvm::Module * module, const unsigned passes)
+{
+   if (!passes)
+      return;
+   llvm::FunctionPassManager fpm(module);
+   if (passes & GGL_SHADER_PASS_SROA)
+      fpm.add(llvm::createSROAPass());
+   if (passes & GGL_SHADER_PASS_MEM2REG)
+      fpm.add(llvm::createPromoteMemoryToRegisterPass());
+   if (passes & GGL_SHADER_PASS_INSTCOMBINE)
+      fpm.add(llvm::createInstructionCombiningPass());
+   if (passes & GGL_SHADER_PASS_GVN)
+      fpm.add(llvm::createGVNPass());
+   if (passes & GGL_SHADER_PASS_SIMPLIFYCFG)
+      fpm.add(llvm::createCFGSimplificationPass());
+   if (passes & GGL_SHADER_PASS_LICM) {
+      fpm.add(llvm::createBasicAliasAnalysisPass()); // sampler descriptors are constant memory
+      fpm.add(llvm::createLICMPass());
+   }
+   if (passes & GGL_SHADER_PASS_BBVECTORIZE) {
+      fpm.add(llvm::createBBVectorizePass());
+      fpm.add(llvm::createInstructionCombiningPass()); // cleans up the vector shuffles
+   }
+   fpm.doInitialization();
+   for (llvm::Module::iterator it = module->begin(); it != module->end(); it++)
+      if (!it->isDeclaration())
+         fpm.run(*it);
+   fpm.doFinalization();
+}
+
+// PF2_JIT_SYMBOLS containing "perf" appends JIT'd functions to /tmp/perf-<pid>.map, and
+// containing "gdb" registers JIT'd objects with the GDB JIT interface
+enum {
+   JIT_SYMBOLS_PERF = 1, JIT_SYMBOLS_GDB = 2
+};
+
+static unsigned jitSymbols;
+static pthread_once_t jitSymbolsOnce = PTHREAD_ONCE_INIT;
+
+static void ReadJITSymbols()
+{
+   const char * env = getenv("PF2_JIT_SYMBOLS");
+   if (env && strstr(env, "perf"))
+      jitSymbols |= JIT_SYMBOLS_PERF;
+   if (env && strstr(env, "gdb"))
+      jitSymbols |= JIT_SYMBOLS_GDB;
+}
+
+// read once, the main and tiered JIT threads both CodeGen
+static unsigned JITSymbols()
+{
+   pthread_once(&jitSymbolsOnce, ReadJITSymbols);
+   return jitSymbols;
+}
+
+// entries are named by the key strings, passes and codegen level, so each permutation
+// profiles apart;
+// opened per entry in append mode, since the tiered JIT thread writes too
+static void WritePerfMap(bcc::ObjectLoader * exec, const char * name, const unsigned passes,
+                         const llvm::CodeGenOpt::Level optLevel)
+{
+   const void * address = exec->getSymbolAddress(name);
+   const size_t size = exec->getSymbolSize(name);
+   if (!address || !size)
+      return;
+   char path[32];
+   snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+   FILE * file = fopen(path, "a");
+   if (!file) {
+      ALOGD("pf2: WritePerfMap failed to open '%s'", path);
+      return;
+   }
+   fprintf(file, "%lx %lx pf2_%s_P%x_O%d\n", (unsigned long)address, (unsigned long)size, name,
+           passes, optLevel);
+   fclose(file);
+}
+
 static void CodeGen(Instance * instance, const char * mainName, gl_shader * shader,
-                    gl_shader_program * program, const GGLState * gglCtx)
+                    gl_shader_program * program, const GGLState * gglCtx, const unsigned passes,
+                    const llvm::CodeGenOpt::Level optLevel)
 {
    bcc::Compiler compiler;
    bcc::Compiler::ErrorCode compile_result;
@@ -399,7 +573,9 @@ static void CodeGen(Instance * instance, const char * mainName, gl_shader * shad
 
 //   instance->module->dump();
 
-   compile_result = compiler.config(bcc::DefaultCompilerConfig());
+   bcc::DefaultCompilerConfig config;
+   config.setOptimizationLevel(optLevel);
+   compile_result = compiler.config(config);
    if (compile_result != bcc::Compiler::kSuccess) {
       ALOGD("failed config compiler (%s)", bcc::Compiler::GetErrorString(compile_result));
       assert(0);
@@ -419,7 +595,8 @@ static void CodeGen(Instance * instance, const char * mainName, gl_shader * shad
    bcc::LookupFunctionSymbolResolver<void*> resolver(SymbolLookup, &ctx);
 
    instance->exec = bcc::ObjectLoader::Load(instance->resultObj.begin(), instance->resultObj.size(),
-                                            /* pName */"glsl", resolver, /* pEnableGDBDebug */false);
+                                            /* pName */"glsl", resolver,
+                                            /* pEnableGDBDebug */JITSymbols() & JIT_SYMBOLS_GDB);
 
    if (!instance->exec) {
       ALOGD("failed to load the result object");
@@ -432,12 +609,181 @@ static void CodeGen(Instance * instance, const char * mainName, gl_shader * shad
    if (!instance->function) {
       ALOGD("Could not find '%s'\n", mainName);
    }
+
+   if (JITSymbols() & JIT_SYMBOLS_PERF) {
+      WritePerfMap(instance->exec, mainName, passes, optLevel);
+      if ('s' == mainName[0]) { // the scanline calls the fragment shader main
+         char shaderMain [SHADER_KEY_STRING_LEN + 6] = {"main"};
+         strcat(shaderMain, mainName + 1 + 2 * sizeof(ShaderKey::ScanLineKey));
+         WritePerfMap(instance->exec, shaderMain, passes, optLevel);
+      }
+   }
 //   else
 //      printf("bcc_compile %s=%p \n", mainName, instance->function);
 
 //   assert(0);
 }
 
+// dump files are <directory>/<function name><suffix>, the function name holds the key strings
+static FILE * OpenDump(const char * directory, const char * name, const char * suffix)
+{
+   char path[512];
+   snprintf(path, sizeof(path), "%s/%s%s", directory, name, suffix);
+   FILE * file = fopen(path, "wb");
+   if (!file)
+      ALOGD("pf2: OpenDump failed to open '%s'", path);
+   return file;
+}
+
+static void DumpModule(const char * directory, const char * name, const char * suffix,
+                       const llvm::Module * module)
+{
+   FILE * file = OpenDump(directory, name, suffix);
+   if (!file)
+      return;
+   llvm::raw_fd_ostream out(fileno(file), /* shouldClose */false);
+   module->print(out, NULL);
+   out.flush();
+   fclose(file);
+}
+
+static unsigned CountInstructions(const llvm::Module * module)
+{
+   unsigned count = 0;
+   for (llvm::Module::const_iterator f = module->begin(); f != module->end(); f++)
+      for (llvm::Function::const_iterator b = f->begin(); b != f->end(); b++)
+         count += b->size();
+   return count;
+}
+
+// optimizes module and JITs it into instance; with a dump directory, the module before and
+// after passes, the object for objdump -d and its sizes are dumped per passes and codegen
+// level, since passes are not in the key strings
+static void JITModule(Instance * instance, llvm::Module * module, const unsigned passes,
+                      const char * functionName, gl_shader * shader, gl_shader_program * program,
+                      const GGLState * gglState, const llvm::CodeGenOpt::Level optLevel)
+{
+   const char * const directory = program->DumpDirectory;
+   char name [SCANLINE_KEY_STRING_LEN + 16] = {0};
+   snprintf(name, sizeof(name), "%s.P%x.O%d", functionName, passes, optLevel);
+   const unsigned instructions = directory ? CountInstructions(module) : 0;
+   if (directory)
+      DumpModule(directory, name, ".before.ll", module);
+   OptimizeModule(module, passes);
+   if (directory)
+      DumpModule(directory, name, ".after.ll", module);
+
+   CodeGen(instance, functionName, shader, program, gglState, passes, optLevel);
+   if (!directory || !instance->exec)
+      return;
+   FILE * file = OpenDump(directory, name, ".o");
+   if (file) {
+      fwrite(instance->resultObj.begin(), 1, instance->resultObj.size(), file);
+      fclose(file);
+   }
+   file = OpenDump(directory, name, ".txt");
+   if (file) {
+      fprintf(file, "passes 0x%x\n", passes);
+      fprintf(file, "llvm instructions %u before passes, %u after\n", instructions,
+              CountInstructions(module));
+      fprintf(file, "object %u bytes, %s %u bytes\n", (unsigned)instance->resultObj.size(),
+              functionName, (unsigned)instance->exec->getSymbolSize(functionName));
+      fclose(file);
+   }
+}
+
+#if USE_TIERED_JIT
+// recompiles hot with its program passes at the highest codegen level
+static Instance * RecompileHot(bcc::BCCContext * compilerCtx, const Instance * hot)
+{
+   bcc::Source * source = bcc::Source::CreateFromBuffer(*compilerCtx, "glsl", hot->bitcode.begin(),
+                                                       hot->bitcode.size());
+   if (!source) {
+      ALOGD("pf2: RecompileHot failed to read bitcode of '%s'", hot->functionName);
+      return NULL;
+   }
+   Instance * instance = new Instance();
+   instance->script = new bcc::Script(*source);
+   JITModule(instance, &source->getModule(), hot->passes, hot->functionName, hot->shader,
+             hot->program, hot->gglState, llvm::CodeGenOpt::Aggressive);
+   if (!instance->function) {
+      delete instance;
+      return NULL;
+   }
+   return instance;
+}
+
+static void * TieredJITThread(void * threadArgs)
+{
+   bcc::BCCContext * compilerCtx = new bcc::BCCContext();
+   pthread_mutex_lock(&tieredJIT.lock);
+   while (true) {
+      while (!tieredJIT.quit && tieredJIT.queue.empty())
+         pthread_cond_wait(&tieredJIT.queueCond, &tieredJIT.lock);
+      if (tieredJIT.quit)
+         break;
+      Instance * hot = tieredJIT.compiling = tieredJIT.queue.front();
+      tieredJIT.queue.pop_front();
+      pthread_mutex_unlock(&tieredJIT.lock);
+
+      Instance * optimized = RecompileHot(compilerCtx, hot);
+
+      pthread_mutex_lock(&tieredJIT.lock);
+      if (optimized) {
+         void (* const function)() = hot->function;
+         hot->optimized = optimized;
+         hot->function = optimized->function;
+         // only swapped while the shader still uses hot, else GGLShaderUse picks it up later
+         __sync_bool_compare_and_swap(&hot->shader->function, function, optimized->function);
+      }
+      tieredJIT.compiling = NULL;
+      pthread_cond_broadcast(&tieredJIT.doneCond);
+   }
+   pthread_mutex_unlock(&tieredJIT.lock);
+   delete compilerCtx;
+   return NULL;
+}
+
+static void QueueHotInstance(Instance * instance)
+{
+   pthread_mutex_lock(&tieredJIT.lock);
+   if (instance && !instance->hot) {
+      instance->hot = true;
+      if (!tieredJIT.thread) {
+         llvm::llvm_start_multithreaded();
+         pthread_attr_t attr;
+         pthread_attr_init(&attr);
+         pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+         int rc = pthread_create(&tieredJIT.thread, &attr, TieredJITThread, NULL);
+         pthread_attr_destroy(&attr);
+         if (rc) {
+            ALOGD("pf2: QueueHotInstance pthread_create failed %d, keeping quick instances", rc);
+            tieredJIT.thread = 0;
+         }
+      }
+      if (tieredJIT.thread) {
+         tieredJIT.queue.push_back(instance);
+         pthread_cond_signal(&tieredJIT.queueCond);
+      }
+   }
+   pthread_mutex_unlock(&tieredJIT.lock);
+}
+#endif
+
+void CountShaderInvocations(gl_shader * shader, const unsigned count)
+{
+#if USE_TIERED_JIT
+   if (!shader->Countdown)
+      return;
+   if (shader->Countdown > count) {
+      shader->Countdown -= count; // racy between scanline threads, only needs to be approximate
+      return;
+   }
+   shader->Countdown = 0;
+   QueueHotInstance(shader->instance);
+#endif
+}
+
 void GenerateScanLine(const GGLState * gglCtx, const gl_shader_program * program, llvm::Module * mod,
                       const char * shaderName, const char * scanlineName);
 
@@ -456,6 +802,7 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
 
       ShaderKey shaderKey;
       GetShaderKey(gglState, shader, &shaderKey);
+      shaderKey.passes = program->Passes;
       Instance * instance = shader->executable->instances[shaderKey];
       bcc::BCCContext * compilerCtx = reinterpret_cast<bcc::BCCContext *>(bccCtx);
       if (!instance) {
@@ -491,7 +838,8 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
 //         }
 //         fclose(file);
 //#endif
-         if (!glsl_ir_to_llvm_module(shader->ir, module, gglState, shaderName)) {
+         if (!glsl_ir_to_llvm_module(shader->ir, module, gglState, shaderName,
+                                     shader->FloatPrecision, program->Uniforms)) {
             assert(0);
             delete module;
          }
@@ -548,15 +896,42 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
 //         fclose(file);
 //#endif
 
+         const char * functionName = mainName;
 #if USE_LLVM_SCANLINE
+         char scanlineName [SCANLINE_KEY_STRING_LEN] = {0};
          if (GL_FRAGMENT_SHADER == shader->Type) {
-            char scanlineName [SCANLINE_KEY_STRING_LEN] = {0};
             GetScanlineKeyString(&shaderKey, scanlineName, sizeof scanlineName / sizeof *scanlineName);
             GenerateScanLine(gglState, program, module, mainName, scanlineName);
-            CodeGen(instance, scanlineName, shader, program, gglState);
-         } else
+            functionName = scanlineName;
+         }
+#endif
+
+         if (program->DumpDirectory) { // the GLSL IR is shared by instances of shader
+            FILE * file = OpenDump(program->DumpDirectory, functionName, ".ir");
+            if (file) {
+               _mesa_print_ir(shader->ir, NULL, file);
+               fclose(file);
+            }
+         }
+
+#if USE_TIERED_JIT
+         // quick JIT first, the unoptimized bitcode is recompiled once the instance is hot
+         llvm::raw_svector_ostream bitcode(instance->bitcode);
+         llvm::WriteBitcodeToFile(module, bitcode);
+         bitcode.flush();
+         instance->functionName = hieralloc_strdup(instance, functionName);
+         instance->shader = shader;
+         instance->program = program;
+         instance->gglState = gglState;
+         instance->passes = shaderKey.passes;
+         if (shaderKey.passes) // no passes means no optimized recompile either
+            instance->countdown = GL_VERTEX_SHADER == shader->Type ? GGL_HOT_VERTICES : GGL_HOT_PIXELS;
+         JITModule(instance, module, shaderKey.passes & GGL_SHADER_PASS_MEM2REG, functionName,
+                   shader, program, gglState, llvm::CodeGenOpt::Less);
+#else
+         JITModule(instance, module, shaderKey.passes, functionName, shader, program, gglState,
+                   llvm::CodeGenOpt::Default);
 #endif
-            CodeGen(instance, mainName, shader, program, gglState);
 
          shader->executable->instances[shaderKey] = instance;
 //         debug_printf("jit new shader '%s'(%p) \n", mainName, instance->function);
@@ -564,6 +939,12 @@ void GGLShaderUse(void * bccCtx, const GGLState * gglState, gl_shader_program *
 //         debug_printf("use cached shader %p \n", instance->function);
          ;
 
+#if USE_TIERED_JIT
+      if (shader->instance) // the countdown continues when the instance is used again
+         shader->instance->countdown = shader->Countdown;
+      shader->instance = instance;
+      shader->Countdown = instance->countdown;
+#endif
       shader->function  = instance->function;
    }
 //   puts("pf2: GGLShaderUse end");
@@ -799,7 +1180,10 @@ void GGLShaderUniformGetSamplers(const gl_shader_program_t * program,
 //         ALOGD("%d uniform.Pos=%d tmu=%d", program->Uniforms->Slots, uniform.Pos, (int)program->ValuesUniform[program->Uniforms->Slots + uniform.Pos][0]);
          sampler2tmu[uniform.Pos] = program->ValuesUniform[program->Uniforms->Slots + uniform.Pos][0];
       } else if (uniform.Type->is_array() && uniform.Type->fields.array->is_sampler())
-         assert(0);
+         for (unsigned j = 0; j < uniform.Type->length &&
+               uniform.Pos + j < GGL_MAXCOMBINEDTEXTUREIMAGEUNITS; j++) // consecutive units
+            sampler2tmu[uniform.Pos + j] = program->ValuesUniform[program->Uniforms->Slots +
+                                                                  uniform.Pos + j][0];
    }
 }
 
@@ -825,7 +1209,14 @@ GLint GGLShaderUniform(gl_shader_program * program, GLint location, GLsizei coun
       return uniform.Pos;
    }
    else if (uniform.Type->is_array() && uniform.Type->fields.array->is_sampler()) {
-      assert(0); // not implemented
+      start = uniform.Pos + program->Uniforms->Slots;
+      if (GL_INT != type || 0 > count || (GLuint)count > uniform.Type->length) {
+         gglError(GL_INVALID_OPERATION);
+         return -2;
+      }
+      for (GLsizei i = 0; i < count; i++)
+         program->ValuesUniform[start + i][0] = ((const float *)values)[i];
+      return uniform.Pos;
    } else
       start = uniform.Pos;
    int slots = 0, elems = 0;
@@ -979,6 +1370,8 @@ void InitializeShaderFunctions(struct GGLInterface * iface)
    iface->ShaderAttach = ShaderAttach;
    iface->ShaderDetach = ShaderDetach;
    iface->ShaderProgramLink = ShaderProgramLink;
+   iface->ShaderProgramPasses = GGLShaderProgramPasses;
+   iface->ShaderProgramDump = GGLShaderProgramDump;
    iface->ShaderUse = ShaderUse;
    iface->ShaderProgramDelete = ShaderProgramDelete;
    iface->ShaderGetiv = GGLShaderGetiv;
@@ -999,6 +1392,9 @@ void InitializeShaderFunctions(struct GGLInterface * iface)
 void DestroyShaderFunctions(GGLInterface * iface)
 {
    GGL_GET_CONTEXT(ctx, iface);
+#if USE_TIERED_JIT
+   CancelHotInstances(NULL, &ctx->state);
+#endif
    _mesa_glsl_release_types();
    _mesa_glsl_release_functions();
    delete ctx->bccCtx;
@@ -20,6 +20,10 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "pixelflinger2.h"
 
@@ -138,9 +142,9 @@ static unsigned texcoordWrap(const unsigned wrap, float r, const unsigned size,
 template<GGLPixelFormat format, ChannelType output, unsigned minMag, unsigned wrapS, unsigned wrapT>
 static void tex2d(unsigned sample[4], const float tex_coord[4], const unsigned sampler)
 {
-   const unsigned * data = (const unsigned *)textureGGLContext->textureState.textureData[sampler];
-   const unsigned width = textureGGLContext->textureState.textureDimensions[sampler * 2];
-	const unsigned height = textureGGLContext->textureState.textureDimensions[sampler * 2 + 1];
+   const unsigned * data = (const unsigned *)textureGGLContext->textureState.samplers[sampler].data;
+   const unsigned width = textureGGLContext->textureState.samplers[sampler].width;
+	const unsigned height = textureGGLContext->textureState.samplers[sampler].height;
     unsigned xLerp = 0, yLerp = 0;
     const unsigned x0 = texcoordWrap(wrapS, tex_coord[0], width, &xLerp);
     const unsigned y0 = texcoordWrap(wrapT, tex_coord[1], height, &yLerp);
@@ -247,9 +251,9 @@ void texcube(unsigned sample[4], const float tex_coord[4], const unsigned sample
     s = (s / ma + 1) * 0.5f;
     t = (t / ma + 1) * 0.5f;
    
-    const unsigned * data = (const unsigned *)textureGGLContext->textureState.textureData[sampler];
-    const unsigned width = textureGGLContext->textureState.textureDimensions[sampler * 2];
-	const unsigned height = textureGGLContext->textureState.textureDimensions[sampler * 2 + 1];
+    const unsigned * data = (const unsigned *)textureGGLContext->textureState.samplers[sampler].data;
+    const unsigned width = textureGGLContext->textureState.samplers[sampler].width;
+	const unsigned height = textureGGLContext->textureState.samplers[sampler].height;
     unsigned xLerp = 0, yLerp = 0;
     const unsigned x0 = texcoordWrap(wrapS, s, width, &xLerp);
     const unsigned y0 = texcoordWrap(wrapT, t, height, &yLerp);
@@ -386,6 +390,208 @@ void AddTextureFunctionMappings(llvm::Module * mod, llvm::ExecutionEngine * ee)
 }
 #endif // #if USE_LLVM_EXECUTIONENGINE && !USE_LLVM_TEXTURE_SAMPLER
 
+static inline unsigned TextureFaceCount(const GGLTexture * texture)
+{
+    return GL_TEXTURE_CUBE_MAP == texture->type ? 6 : 1;
+}
+
+unsigned TextureLevelOffset(const GGLTexture * texture, const unsigned level, const unsigned face)
+{
+    assert(level < texture->levelCount || (0 == level && 0 == texture->levelCount));
+    assert(face < TextureFaceCount(texture));
+    unsigned offset = 0;
+    for (unsigned i = 0; i < level; i++)
+        offset += MAX2(texture->width >> i, 1u) * MAX2(texture->height >> i, 1u);
+    offset *= TextureFaceCount(texture);
+    return offset + face * MAX2(texture->width >> level, 1u) * MAX2(texture->height >> level, 1u);
+}
+
+unsigned GGLTextureLevelsSize(const GGLTexture * texture)
+{
+    const unsigned levelCount = MAX2(texture->levelCount, 1u);
+    unsigned texels = 0;
+    for (unsigned i = 0; i < levelCount; i++)
+        texels += MAX2(texture->width >> i, 1u) * MAX2(texture->height >> i, 1u);
+    return texels * TextureFaceCount(texture) * PixelFormatSize(texture->format);
+}
+
+static void TexSubImage(GGLInterface * iface, GGLTexture * texture, unsigned level,
+                        unsigned face, GLint x, GLint y, GLsizei width, GLsizei height,
+                        GGLPixelFormat format, unsigned stride, const void * pixels,
+                        GLboolean premultiply)
+{
+    if (!texture || !texture->levels || !pixels)
+        return gglError(GL_INVALID_VALUE);
+    if (level >= MAX2(texture->levelCount, 1u) || face >= TextureFaceCount(texture))
+        return gglError(GL_INVALID_VALUE);
+    const unsigned levelWidth = MAX2(texture->width >> level, 1u);
+    const unsigned levelHeight = MAX2(texture->height >> level, 1u);
+    if (0 > x || 0 > y || 0 > width || 0 > height ||
+            x + width > (GLint)levelWidth || y + height > (GLint)levelHeight)
+        return gglError(GL_INVALID_VALUE);
+    if (!stride)
+        stride = width;
+
+    const unsigned srcSize = PixelFormatSize(format), dstSize = PixelFormatSize(texture->format);
+    unsigned char * dst = (unsigned char *)texture->levels +
+                          (TextureLevelOffset(texture, level, face) + y * levelWidth + x) * dstSize;
+    const unsigned char * src = (const unsigned char *)pixels;
+    if (format == texture->format && !premultiply && levelWidth == (unsigned)width &&
+            stride == (unsigned)width) // whole level in one copy
+        return (void)memcpy(dst, src, width * height * dstSize);
+    for (GLsizei i = 0; i < height; i++, dst += levelWidth * dstSize, src += stride * srcSize)
+        ConvertPixels(dst, texture->format, src, format, width, premultiply);
+}
+
+static void TexImage(GGLInterface * iface, GGLTexture * texture, unsigned level, unsigned face,
+                     GGLPixelFormat format, unsigned stride, const void * pixels,
+                     GLboolean premultiply)
+{
+    if (!texture)
+        return gglError(GL_INVALID_VALUE);
+    TexSubImage(iface, texture, level, face, 0, 0, MAX2(texture->width >> level, 1u),
+                MAX2(texture->height >> level, 1u), format, stride, pixels, premultiply);
+}
+
+static void GenerateMipmap(GGLInterface * iface, GGLTexture * texture)
+{
+    if (!texture || !texture->levels)
+        return gglError(GL_INVALID_VALUE);
+    if (texture->levelCount <= 1)
+        return;
+    // mipmapped textures must be power of 2, so each level is exactly half of the previous,
+    // except for dimensions that already reached 1
+    if (!TexturePowerOf2(texture))
+        return gglError(GL_INVALID_OPERATION);
+
+    const unsigned size = PixelFormatSize(texture->format);
+    const bool rgba = GGL_PIXEL_FORMAT_RGBA_8888 == texture->format;
+    // 2 source rows and 1 destination row in rgba_8888, with room to replicate a 1 texel column
+    unsigned * const rows = (unsigned *)malloc((3 * texture->width + 4) * sizeof(*rows));
+    if (!rows)
+        return gglError(GL_OUT_OF_MEMORY);
+    unsigned * const a = rows, * const b = a + texture->width + 2;
+    unsigned * const d = b + texture->width + 2;
+
+    for (unsigned level = 1; level < texture->levelCount; level++) {
+        const unsigned srcWidth = MAX2(texture->width >> (level - 1), 1u);
+        const unsigned srcHeight = MAX2(texture->height >> (level - 1), 1u);
+        const unsigned width = MAX2(srcWidth >> 1, 1u), height = MAX2(srcHeight >> 1, 1u);
+        for (unsigned face = 0; face < TextureFaceCount(texture); face++) {
+            const unsigned char * src = (const unsigned char *)texture->levels +
+                                        TextureLevelOffset(texture, level - 1, face) * size;
+            unsigned char * dst = (unsigned char *)texture->levels +
+                                  TextureLevelOffset(texture, level, face) * size;
+            for (unsigned y = 0; y < height; y++, dst += width * size) {
+                const unsigned char * top = src + 2 * y * srcWidth * size;
+                const unsigned char * bottom = srcHeight > 1 ? top + srcWidth * size : top;
+                ConvertPixels(a, GGL_PIXEL_FORMAT_RGBA_8888, top, texture->format, srcWidth, false);
+                ConvertPixels(b, GGL_PIXEL_FORMAT_RGBA_8888, bottom, texture->format, srcWidth, false);
+                if (1 == srcWidth) { // replicate column so filter sees 2x2 blocks
+                    a[1] = a[0];
+                    b[1] = b[0];
+                }
+                BoxFilterRGBA(rgba ? (unsigned *)dst : d, a, b, width);
+                if (!rgba)
+                    ConvertPixels(dst, texture->format, d, GGL_PIXEL_FORMAT_RGBA_8888, width, false);
+            }
+        }
+    }
+    free(rows);
+}
+
+// formats the sampler can read, others are rejected since the file header is untrusted
+static bool SamplerFormat(const unsigned format)
+{
+    return GGL_PIXEL_FORMAT_RGBA_8888 == format || GGL_PIXEL_FORMAT_RGBX_8888 == format ||
+           GGL_PIXEL_FORMAT_RGB_565 == format;
+}
+
+GLboolean GGLTextureMapFile(const char * path, GGLTexture * texture)
+{
+    const int fd = open(path, O_RDONLY);
+    if (0 > fd)
+        return GL_FALSE;
+    struct stat st;
+    GGLTextureFileHeader header;
+    if (fstat(fd, &st) || sizeof(header) != read(fd, &header, sizeof(header))) {
+        close(fd);
+        return GL_FALSE;
+    }
+
+    memset(texture, 0, sizeof(*texture));
+    texture->type = header.type;
+    texture->format = (GGLPixelFormat)header.format;
+    texture->width = header.width;
+    texture->height = header.height;
+    texture->levelCount = header.levelCount;
+    if (GGL_TEXTURE_FILE_MAGIC != header.magic || GGL_TEXTURE_FILE_VERSION != header.version ||
+            GGL_TEXTURE_FILE_TILING_LINEAR != header.tiling ||
+            GGL_TEXTURE_FILE_DATA_OFFSET != header.dataOffset ||
+            (GL_TEXTURE_2D != header.type && GL_TEXTURE_CUBE_MAP != header.type) ||
+            !SamplerFormat(header.format) ||
+            !header.width || !header.height || header.width > GGL_MAX_VIEWPORT_DIMS ||
+            header.height > GGL_MAX_VIEWPORT_DIMS || header.levelCount > GGL_MAX_TEXTURE_LEVELS ||
+            (header.levelCount > 1 && !TexturePowerOf2(texture)) || // mip chains are POT only
+            GGLTextureLevelsSize(texture) != header.dataSize ||
+            (off_t)(header.dataOffset + header.dataSize) > st.st_size) {
+        ALOGD("pf2: GGLTextureMapFile invalid texture file '%s' \n", path);
+        memset(texture, 0, sizeof(*texture));
+        close(fd);
+        return GL_FALSE;
+    }
+
+    // pages of levels are only read in when sampled
+    void * map = mmap(NULL, header.dataOffset + header.dataSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        memset(texture, 0, sizeof(*texture));
+        return GL_FALSE;
+    }
+    texture->levels = (char *)map + header.dataOffset;
+    return GL_TRUE;
+}
+
+void GGLTextureUnmapFile(GGLTexture * texture)
+{
+    if (!texture->levels)
+        return;
+    void * map = (char *)texture->levels - GGL_TEXTURE_FILE_DATA_OFFSET;
+    const GGLTextureFileHeader * header = (const GGLTextureFileHeader *)map;
+    assert(GGL_TEXTURE_FILE_MAGIC == header->magic);
+    munmap(map, header->dataOffset + header->dataSize);
+    texture->levels = NULL;
+}
+
+GLboolean GGLTextureWriteFile(const char * path, const GGLTexture * texture)
+{
+    if (!texture->levels)
+        return GL_FALSE;
+    GGLTextureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = GGL_TEXTURE_FILE_MAGIC;
+    header.version = GGL_TEXTURE_FILE_VERSION;
+    header.type = texture->type;
+    header.format = texture->format;
+    header.width = texture->width;
+    header.height = texture->height;
+    header.levelCount = texture->levelCount;
+    header.tiling = GGL_TEXTURE_FILE_TILING_LINEAR;
+    header.dataOffset = GGL_TEXTURE_FILE_DATA_OFFSET;
+    header.dataSize = GGLTextureLevelsSize(texture);
+
+    FILE * file = fopen(path, "wb");
+    if (!file)
+        return GL_FALSE;
+    char padding[GGL_TEXTURE_FILE_DATA_OFFSET - sizeof(header)];
+    memset(padding, 0, sizeof(padding));
+    bool success = 1 == fwrite(&header, sizeof(header), 1, file);
+    success = success && 1 == fwrite(padding, sizeof(padding), 1, file);
+    success = success && 1 == fwrite(texture->levels, header.dataSize, 1, file);
+    success = !fclose(file) && success;
+    return success ? GL_TRUE : GL_FALSE;
+}
+
 static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture * texture)
 {
     assert(GGL_MAXCOMBINEDTEXTUREIMAGEUNITS > sampler);
@@ -402,25 +608,69 @@ static void SetSampler(GGLInterface * iface, const unsigned sampler, GGLTexture
         SetShaderVerifyFunctions(iface);
     else if (ctx->state.textureState.textures[sampler].magFilter != texture->magFilter)
         SetShaderVerifyFunctions(iface);
+    else if (TexturePowerOf2(ctx->state.textureState.textures + sampler) != TexturePowerOf2(texture))
+        SetShaderVerifyFunctions(iface);
              
     if (texture)
     {
         ctx->state.textureState.textures[sampler] = *texture; // shallow copy, data pointed to must remain valid 
-        //ctx->state.textureState.textureData[sampler] = texture->levels[0];
-        ctx->state.textureState.textureData[sampler] = texture->levels;
-        ctx->state.textureState.textureDimensions[sampler * 2] = texture->width;
-        ctx->state.textureState.textureDimensions[sampler * 2 + 1] = texture->height;
+        GGLSamplerDescriptor & desc = ctx->state.textureState.samplers[sampler];
+        desc.data = texture->levels;
+        desc.width = texture->width;
+        desc.height = texture->height;
+        desc.widthMask = texture->width - 1;
+        desc.heightMask = texture->height - 1;
+        desc.widthShift = 0;
+        if (TexturePowerOf2(texture))
+            while ((1u << desc.widthShift) < texture->width)
+                desc.widthShift++;
+        desc.stride = texture->width;
+        desc.faceSize = texture->width * texture->height;
+        desc.maxLevel = MIN2(MAX2(texture->levelCount, 1u), (unsigned)GGL_MAX_TEXTURE_LEVELS) - 1;
+        for (unsigned i = 0; i < GGL_MAX_TEXTURE_LEVELS; i++)
+            desc.levelOffsets[i] = i <= desc.maxLevel ? TextureLevelOffset(texture, i, 0) : 0;
     }
     else
     {
         memset(ctx->state.textureState.textures + sampler, 0, sizeof(ctx->state.textureState.textures[sampler]));
-        ctx->state.textureState.textureData[sampler] = NULL;
-        ctx->state.textureState.textureDimensions[sampler * 2] = 0;
-        ctx->state.textureState.textureDimensions[sampler * 2 + 1] = 0;
+        memset(ctx->state.textureState.samplers + sampler, 0, sizeof(ctx->state.textureState.samplers[sampler]));
+    }
+}
+
+// the level is row major with stride of level width like GGLSurface, so it is used in place
+static void SetBufferTexture(GGLInterface * iface, GGLTexture * texture, unsigned level,
+                             unsigned face)
+{
+    if (!texture)
+        return iface->SetBuffer(iface, GL_COLOR_BUFFER_BIT, NULL);
+    if (!texture->levels || level >= MAX2(texture->levelCount, 1u) ||
+            face >= TextureFaceCount(texture))
+        return gglError(GL_INVALID_VALUE);
+    switch (texture->format) { // formats both sampler and scanline support
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+    case GGL_PIXEL_FORMAT_RGB_565:
+        break;
+    default:
+        ALOGD("pf2: SetBufferTexture format=0x%.02X \n", texture->format);
+        return gglError(GL_INVALID_OPERATION);
     }
+    GGLSurface surface;
+    memset(&surface, 0, sizeof(surface));
+    surface.width = MAX2(texture->width >> level, 1u);
+    surface.height = MAX2(texture->height >> level, 1u);
+    surface.format = texture->format;
+    surface.data = (char *)texture->levels +
+                   TextureLevelOffset(texture, level, face) * PixelFormatSize(texture->format);
+    surface.stride = surface.width;
+    iface->SetBuffer(iface, GL_COLOR_BUFFER_BIT, &surface);
 }
 
 void InitializeTextureFunctions(GGLInterface * iface)
 {
+    iface->TexImage = TexImage;
+    iface->TexSubImage = TexSubImage;
+    iface->GenerateMipmap = GenerateMipmap;
     iface->SetSampler = SetSampler;
+    iface->SetBufferTexture = SetBufferTexture;
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+/**
+ **
+ ** Copyright 2010, The Android Open Source Project
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+#include "src/pixelflinger2/pixelflinger2.h"
+
+#include <string.h>
+
+static const GLbitfield tileBits[3] = {GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT,
+                                       GL_STENCIL_BUFFER_BIT
+                                      };
+
+// SZ_24 depth and stencil are one surface, so the tile buffer of either holds both
+static inline bool SharedDepthStencil(const GGLContext * ctx)
+{
+   return ctx->stencilSurface.data && ctx->stencilSurface.data == ctx->depthSurface.data;
+}
+
+// bits held by tile buffer i; the shared SZ_24 buffer is loaded and written back as depth
+static inline GLbitfield TileBits(const GGLContext * ctx, const unsigned i)
+{
+   if (!i || !SharedDepthStencil(ctx))
+      return tileBits[i];
+   return 1 == i ? GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT : 0;
+}
+
+static inline void TileSurfaces(const GGLContext * ctx, const unsigned i,
+                                const GGLSurface ** surface, GGLSurface ** tile)
+{
+   const GGLSurface * const surfaces[3] = {&ctx->frameSurface, &ctx->depthSurface,
+                                           &ctx->stencilSurface
+                                          };
+   GGLSurface * const tiles[3] = {&ctx->tile.frameSurface, &ctx->tile.depthSurface,
+                                  &ctx->tile.stencilSurface
+                                 };
+   *surface = surfaces[i];
+   *tile = tiles[i];
+}
+
+// copies the current tile between surface and tile buffer
+static void CopyTile(const GGLContext * ctx, const GGLSurface * surface, const GGLSurface * tile,
+                     const bool load)
+{
+   const unsigned size = PixelFormatSize(surface->format);
+   const unsigned bytes = tile->width * size;
+   char * row = (char *)surface->data + (ctx->tile.y * surface->width + ctx->tile.x) * size;
+   char * tileRow = (char *)tile->data;
+   for (unsigned y = 0; y < tile->height; y++, row += surface->width * size, tileRow += bytes)
+      if (load)
+         memcpy(tileRow, row, bytes);
+      else
+         memcpy(row, tileRow, bytes);
+}
+
+void PrepareTile(const GGLContext * ctx, GLbitfield written, GLbitfield overwritten)
+{
+   assert(ctx->tile.active);
+   if (SharedDepthStencil(ctx)) {
+      // overwriting only one of depth or stencil keeps the other, so it must be loaded
+      const GLbitfield depthStencil = GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+      if ((overwritten & depthStencil) && (overwritten & depthStencil) != depthStencil) {
+         written |= overwritten & depthStencil;
+         overwritten &= ~depthStencil;
+      }
+   }
+   // checked first, since worker thread scanlines only get here after the main thread did
+   if ((ctx->tile.dirty & (written | overwritten)) == (written | overwritten) &&
+         (ctx->tile.loaded & written) == written)
+      return;
+   ctx->tile.loaded |= overwritten;
+   ctx->tile.invalidated &= ~overwritten;
+   for (unsigned i = 0; i < 3; i++) {
+      const GLbitfield bits = TileBits(ctx, i);
+      if (!(written & ~ctx->tile.loaded & bits))
+         continue;
+      const GGLSurface * surface = NULL;
+      GGLSurface * tile = NULL;
+      TileSurfaces(ctx, i, &surface, &tile);
+      if (surface->data)
+         CopyTile(ctx, surface, tile, true);
+      ctx->tile.loaded |= bits;
+   }
+   ctx->tile.dirty |= written | overwritten;
+}
+
+static void RenderTiles(GGLInterface * iface, void (* draw)(GGLInterface * iface, void * user),
+                        void * user)
+{
+   GGL_GET_CONTEXT(ctx, iface);
+   if (!draw)
+      return gglError(GL_INVALID_VALUE);
+   if (ctx->tile.active || ctx->multisample.enable)
+      return gglError(GL_INVALID_OPERATION);
+   ResolveLazyClear(ctx); // tiles are loaded from the surfaces
+
+   void * const buffers[3] = {ctx->tile.color, ctx->tile.depth, ctx->tile.stencil};
+   const GLbitfield invalidated = ctx->tile.invalidated;
+   const unsigned width = ctx->frameSurface.width, height = ctx->frameSurface.height;
+   for (unsigned y = 0; y < height; y += GGL_RENDER_TILE_SIZE)
+      for (unsigned x = 0; x < width; x += GGL_RENDER_TILE_SIZE) {
+         ctx->tile.x = x;
+         ctx->tile.y = y;
+         ctx->tile.width = MIN2(GGL_RENDER_TILE_SIZE, width - x);
+         ctx->tile.height = MIN2(GGL_RENDER_TILE_SIZE, height - y);
+         for (unsigned i = 0; i < 3; i++) {
+            const GGLSurface * surface = NULL;
+            GGLSurface * tile = NULL;
+            TileSurfaces(ctx, i, &surface, &tile);
+            *tile = *surface;
+            tile->width = tile->stride = ctx->tile.width;
+            tile->height = ctx->tile.height;
+            tile->data = surface->data ? buffers[i] : NULL;
+         }
+         if (SharedDepthStencil(ctx))
+            ctx->tile.stencilSurface.data = ctx->tile.depthSurface.data;
+
+         // every tile starts with the buffers invalidated before RenderTiles
+         ctx->tile.invalidated = invalidated;
+         ctx->tile.loaded = invalidated;
+         ctx->tile.dirty = 0;
+         ctx->tile.active = true;
+         draw(iface, user);
+         ctx->tile.active = false;
+
+         for (unsigned i = 0; i < 3; i++) {
+            const GGLSurface * surface = NULL;
+            GGLSurface * tile = NULL;
+            TileSurfaces(ctx, i, &surface, &tile);
+            if ((ctx->tile.dirty & TileBits(ctx, i)) && surface->data)
+               CopyTile(ctx, surface, tile, false);
+         }
+      }
+}
+
+static void InvalidateBuffers(const GGLInterface * iface, GLbitfield buf)
+{
+   GGL_GET_CONST_CONTEXT(ctx, iface);
+   buf &= GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+   ctx->tile.invalidated |= buf;
+   if (!ctx->tile.active)
+      return;
+   ctx->tile.dirty &= ~buf;
+   ctx->tile.loaded |= buf;
+}
+
+void InitializeTileFunctions(GGLInterface * iface)
+{
+   iface->RenderTiles = RenderTiles;
+   iface->InvalidateBuffers = InvalidateBuffers;
+}